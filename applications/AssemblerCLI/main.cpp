@@ -1,57 +1,238 @@
 #include <iostream>
+#include <algorithm>
+#include <charconv>
+#include <map>
 
 #include "dirent.h"
 #include "Assembler.h"
 #include "VMTranslator.h"
 
+// Assembles every input on a pool of jobs workers, each with its own Assembler, then reports per file
+int assembleBatch(const std::vector<std::string>& pathNames, const Assembler::Options& options, unsigned jobs)
+{
+    std::vector<fs::path> inputs;
+    for (const auto& pathName : pathNames)
+    {
+        fs::path input{ pathName };
+        if (input.extension() == ".asm")
+        {
+            inputs.push_back(input);
+        }
+        else if (DIR* dir = opendir(pathName.c_str()))
+        {
+            std::vector<std::string> fileNames;
+            auto dirEnt = readdir(dir);
+            while (dirEnt)
+            {
+                if (dirEnt->d_type == DT_REG || dirEnt->d_type == DT_LNK)
+                {
+                    fs::path curFile(pathName + "/" + dirEnt->d_name);
+                    if (curFile.extension() == ".asm")
+                        fileNames.push_back(curFile.fullFileName());
+                }
+                dirEnt = readdir(dir);
+            }
+            closedir(dir);
+            std::sort(fileNames.begin(), fileNames.end());
+            inputs.insert(inputs.end(), fileNames.begin(), fileNames.end());
+        }
+        else
+        {
+            std::cout << "Invalid input " << pathName << '\n';
+            return 1;
+        }
+    }
+
+    std::vector<Assembler::AssemblyResult> results(inputs.size());
+    Utilities::parallelFor(inputs.size(), jobs, [&](size_t i)
+    {
+        Assembler::Assembler assembler{ options };
+        results[i] = assembler.assembleFile(inputs[i]);
+    });
+
+    int failed{};
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        if (results[i].ok())
+        {
+            std::cout << inputs[i].fullFileName() << ": " << results[i].words.size() << " words\n";
+            continue;
+        }
+        ++failed;
+        for (const auto& diagnostic : results[i].diagnostics)
+            std::cout << inputs[i].fullFileName() << ":Ln-" << diagnostic.line << " : " << diagnostic.message << '\n';
+    }
+    std::cout << "Assembled " << inputs.size() - failed << " of " << inputs.size() << " files\n";
+    return failed ? 1 : 0;
+}
+
+void printUsage()
+{
+    std::cout << "Usage: <input file/directory> [-singlePass] [-threads <count>] [-binary [-header]]" << '\n';
+    std::cout << "       <.vm/.vmb file/directory> [-foldConstants] [-inline <count>] [-removeDeadFunctions]" << '\n';
+    std::cout << "           [-fuseMoves] [-cacheTop] [-compareBranch] [-localLoop <count>] [-peephole]" << '\n';
+    std::cout << "           [-sharedCallReturn] [-sharedCompare] [-tailCalls] [-stream] [-threads <count>]" << '\n';
+    std::cout << "       -batch [-jobs <count>] <.asm files/directories...> [assembler options]" << '\n';
+}
+
+// Parses the whole of text as a count, 0 or more. Prints the error and usage and returns false otherwise.
+bool parseCount(const std::string& option, std::string_view text, int& value)
+{
+    const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (error == std::errc{} && end == text.data() + text.size() && value >= 0)
+        return true;
+    std::cout << "Invalid value " << text << " for " << option << '\n';
+    printUsage();
+    return false;
+}
+
 int main(int argc, char* argv[])
 {
     if (argc <= 1)
     {
-        std::cout << "Usage: <input file/directory>" << '\n';
+        printUsage();
         return 1;
     }
-    
-    std::string pathName{argv[1]};
-    if(pathName.back() == '\\' || pathName.back() == '/')
-        pathName = pathName.substr(0, pathName.size()-1);
+
+    Assembler::Options assemblerOptions;
+    VMTranslator::Options translatorOptions;
+    std::vector<std::string> pathNames;
+    bool batch{};
+    unsigned jobs{};
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string option{ argv[i] };
+        if (option == "-singlePass")
+            assemblerOptions.singlePass = true;
+        else if (option == "-threads" && i + 1 < argc)
+        {
+            int threads{};
+            if (!parseCount(option, argv[++i], threads))
+                return 1;
+            assemblerOptions.threads = translatorOptions.threads = static_cast<unsigned>(threads);
+        }
+        else if (option == "-binary")
+            assemblerOptions.format = Assembler::OutputFormat::Binary;
+        else if (option == "-header")
+            assemblerOptions.romHeader = true;
+        else if (option == "-foldConstants")
+            translatorOptions.foldConstants = true;
+        else if (option == "-inline" && i + 1 < argc)
+        {
+            if (!parseCount(option, argv[++i], translatorOptions.inlineThreshold))
+                return 1;
+        }
+        else if (option == "-removeDeadFunctions")
+            translatorOptions.removeDeadFunctions = true;
+        else if (option == "-fuseMoves")
+            translatorOptions.fuseMoves = true;
+        else if (option == "-cacheTop")
+            translatorOptions.cacheTop = true;
+        else if (option == "-compareBranch")
+            translatorOptions.compareBranch = true;
+        else if (option == "-localLoop" && i + 1 < argc)
+        {
+            if (!parseCount(option, argv[++i], translatorOptions.localLoopThreshold))
+                return 1;
+        }
+        else if (option == "-peephole")
+            translatorOptions.peephole = true;
+        else if (option == "-sharedCallReturn")
+            translatorOptions.sharedCallReturn = true;
+        else if (option == "-sharedCompare")
+            translatorOptions.sharedCompare = true;
+        else if (option == "-tailCalls")
+            translatorOptions.tailCalls = true;
+        else if (option == "-stream")
+            translatorOptions.stream = true;
+        else if (option == "-batch")
+            batch = true;
+        else if (option == "-jobs" && i + 1 < argc)
+        {
+            int count{};
+            if (!parseCount(option, argv[++i], count))
+                return 1;
+            jobs = static_cast<unsigned>(count);
+        }
+        else if (option.empty() || option.front() == '-')
+        {
+            std::cout << "Unknown option " << option << '\n';
+            return 1;
+        }
+        else
+        {
+            if(option.back() == '\\' || option.back() == '/')
+                pathNames.push_back(option.substr(0, option.size()-1));
+            else
+                pathNames.push_back(option);
+        }
+    }
+
+    if (assemblerOptions.romHeader && assemblerOptions.format != Assembler::OutputFormat::Binary)
+    {
+        std::cout << "-header requires -binary\n";
+        printUsage();
+        return 1;
+    }
+
+    // Whole program passes need every file at once, which streaming never has
+    if (translatorOptions.stream && (translatorOptions.removeDeadFunctions || translatorOptions.inlineThreshold > 0))
+    {
+        std::cout << (translatorOptions.removeDeadFunctions ? "-removeDeadFunctions" : "-inline") << " cannot be combined with -stream\n";
+        printUsage();
+        return 1;
+    }
+
+    if (batch || pathNames.size() > 1)
+        return assembleBatch(pathNames, assemblerOptions, jobs);
+    if (pathNames.empty())
+    {
+        std::cout << "No input given\n";
+        return 1;
+    }
+
+    const std::string& pathName{ pathNames.front() };
 
     fs::path input{ pathName };
     if (input.extension() == ".asm")
     {
-        Assembler::Assembler assembler;
+        Assembler::Assembler assembler{ assemblerOptions };
         return assembler.parse(input);
     }
-    else if (input.extension() == ".vm")
+    else if (input.extension() == ".vm" || input.extension() == ".vmb")
     {
         std::vector<fs::path> inputs = {input};
         fs::path output = input;
         output.replace_extension("asm");
-        VMTranslator::Translator translator(output);
+        VMTranslator::Translator translator(output, translatorOptions);
         return translator.parse(inputs);
     }
 
-    if(DIR* dir = opendir(argv[1]))
+    if(DIR* dir = opendir(pathName.c_str()))
     {
         const auto penultSlash = pathName.find_last_of("\\/", pathName.size() - 2);
         const auto outputFileName = pathName.substr(penultSlash != std::string::npos ? penultSlash + 1 : 0);
         fs::path output(pathName + '/' + outputFileName + ".asm");
-        VMTranslator::Translator translator(output);
-        std::vector<fs::path> inputs;
+        VMTranslator::Translator translator(output, translatorOptions);
+        // Bytecode takes the place of the text of the same class
+        std::map<std::string, fs::path> units;
         auto dirEnt = readdir(dir);
         while(dirEnt)
         {
             if(dirEnt->d_type == DT_REG || dirEnt->d_type == DT_LNK)
             {
                 fs::path curFile(pathName + "/" + dirEnt->d_name);
-                if (curFile.extension() == ".vm")
-                {
-                    inputs.push_back(curFile);
-                }
+                if (curFile.extension() == ".vmb")
+                    units.insert_or_assign(curFile.filename(), curFile);
+                else if (curFile.extension() == ".vm")
+                    units.emplace(curFile.filename(), curFile);
             }
             dirEnt = readdir(dir);
         }
         closedir(dir);
+        std::vector<fs::path> inputs;
+        for (const auto& unit : units)
+            inputs.push_back(unit.second);
         return translator.parse(inputs);
     }
     else
@@ -6,7 +6,7 @@
 #include "Tokenizer.h"
 #include "CompilationEngine.h"
 
-int compileJackFile(const fs::path& input, bool outputXML)
+int compileJackFile(const fs::path& input, bool outputXML, bool binary)
 {
     try
     {
@@ -16,11 +16,12 @@ int compileJackFile(const fs::path& input, bool outputXML)
         tokenizer.parse(input);
         // Compile
         fs::path outputVM = input;
-        outputVM.replace_extension("vm");
-        std::ofstream vmFile(outputVM.fullFileName());
-        Compiler::VMWriter vmWriter{&vmFile};
+        outputVM.replace_extension(binary ? "vmb" : "vm");
+        std::ofstream vmFile(outputVM.fullFileName(), binary ? std::ios::binary : std::ios::out);
+        Compiler::VMWriter vmWriter{&vmFile, binary};
         Compiler::CompilationEngine compiler(&tokenizer, &vmWriter);
         compiler.startCompilation();
+        vmWriter.flush();
         if(outputXML)
         {
             // Write Tokens XML
@@ -49,16 +50,26 @@ int compileJackFile(const fs::path& input, bool outputXML)
 int main(int argc, char* argv[])
 {
     bool outputXML{};
+    bool binary{};
     if (argc <= 1)
     {
-        std::cout << "Usage: <input file/directory>" << '\n';
+        std::cout << "Usage: <input file/directory> [-outputXML] [-binary]" << '\n';
         return 1;
     }
-    else if(argc > 2)
+    for (int i = 2; i < argc; i++)
     {
-        outputXML = argv[2] == "-outputXML";
+        const std::string option{ argv[i] };
+        if (option == "-outputXML")
+            outputXML = true;
+        else if (option == "-binary")
+            binary = true;
+        else
+        {
+            std::cout << "Unknown option " << option << '\n';
+            return 1;
+        }
     }
-    
+
     std::string pathName{argv[1]};
     if(pathName.back() == '\\' || pathName.back() == '/')
         pathName = pathName.substr(0, pathName.size()-1);
@@ -66,7 +77,7 @@ int main(int argc, char* argv[])
     fs::path input{ pathName };
     if (input.extension() == ".jack")
     {
-        return compileJackFile(input, outputXML);
+        return compileJackFile(input, outputXML, binary);
     }
     else if(DIR* dir = opendir(argv[1]))
     {
@@ -79,7 +90,7 @@ int main(int argc, char* argv[])
                 fs::path curFile(pathName + "/" + dirEnt->d_name);
                 if (curFile.extension() == ".jack")
                 {
-                    int compilerResult = compileJackFile(curFile, outputXML);
+                    int compilerResult = compileJackFile(curFile, outputXML, binary);
                     result = compilerResult > result ? compilerResult : result;
                 }
             }
@@ -1,43 +1,54 @@
 #include <fstream>
+#include <charconv>
+#include <array>
+#include <cstring>
+#include <algorithm>
+#include <thread>
 #include "Assembler.h"
 
 namespace Assembler
 {
+    namespace
+    {
+        // The eight binary digits of every byte value, most significant first
+        constexpr std::array<std::array<char, 8>, 256> makeByteDigits()
+        {
+            std::array<std::array<char, 8>, 256> table{};
+            for (size_t value = 0; value < table.size(); value++)
+                for (size_t bit = 0; bit < 8; bit++)
+                    table[value][bit] = (value >> (7 - bit)) & 1 ? '1' : '0';
+            return table;
+        }
+        constexpr auto byteDigits = makeByteDigits();
+    }
+
     void Assembler::reset()
     {
         m_nextAvailableVariable = 16;
-        m_symbolToValue = initSymbols;
+        m_symbols.clear();
         m_resultLines.clear();
+        m_fixups.clear();
+        m_diagnostics.clear();
     }
     bool Assembler::startswith(const std::string& str, const std::string& cmp)
     {
         return str.compare(0, cmp.length(), cmp) == 0;
     }
 
-    void Assembler::setBits(std::bitset<16>& bits, size_t start, const std::vector<bool>& values)
-    {
-        size_t end = start + values.size();
-        size_t iVal{};
-        for (size_t i = start; i < 15 && i < end; i++)
-        {
-            bits[i] = values[iVal++];
-        }
-    }
-
-    std::string Assembler::parseSymbolLine(const std::string& line, unsigned long& symbolLine)
+    std::string Assembler::parseSymbolLine(std::string_view line, unsigned long& symbolLine)
     {
         std::string error{};
 
-        std::string lineString = line.substr(0, line.find("//"));
+        std::string_view lineString = line.substr(0, line.find("//"));
         if (lineString.empty())
             return error;
         const char& firstChar{ lineString[0] };
         if (firstChar == '(')
         {
-            std::string symbol = line.substr(1, line.find(')') - 1);
-            if (m_symbolToValue.find(symbol) == m_symbolToValue.end())
+            std::string_view symbol = line.substr(1, line.find(')') - 1);
+            if (m_symbols.insert(symbol, static_cast<uint16_t>(symbolLine)))
             {
-                m_symbolToValue[symbol] = symbolLine--;
+                symbolLine--;
             }
             else
             {
@@ -49,14 +60,28 @@ namespace Assembler
         return error;
     }
 
-    LineParseResult Assembler::parseCodeLine(const std::string& line)
+    LineParseResult Assembler::parseCodeLine(std::string_view line)
+    {
+        LineParseResult result = encodeLine(line);
+        if (result.unresolved && !m_options.singlePass)
+        {
+            // Not a label, so a new variable
+            m_symbols.insert(result.symbol, static_cast<uint16_t>(m_nextAvailableVariable));
+            result.bin = static_cast<uint16_t>(m_nextAvailableVariable++);
+            result.symbol = {};
+            result.unresolved = false;
+        }
+        return result;
+    }
+
+    LineParseResult Assembler::encodeLine(std::string_view line) const
     {
         LineParseResult result;
-        std::string lineString = Utilities::trimSpaceAndComment(line);
-        const char& firstChar{ lineString[0] };
+        std::string_view lineString = Utilities::trimSpaceAndComment(line);
+        const char firstChar{ lineString.empty() ? '\0' : lineString[0] };
         if (firstChar == '(')
         {
-            std::string symbol = line.substr(1, line.find(')'));
+            std::string_view symbol = line.substr(1, line.find(')'));
             if (!symbol.empty())
             {
                 result.symbol = symbol;
@@ -68,64 +93,54 @@ namespace Assembler
         }
         else if (firstChar == '@')
         {
-            std::stringstream ss(lineString);
             // A Instruction
             const auto symbol = lineString.substr(1);
-            auto valueItr = m_symbolToValue.find(symbol);
-            if (valueItr != m_symbolToValue.end())
-            {
-                result.bin = valueItr->second;
-            }
-            else if (symbol.find_first_not_of("0123456789") != std::string::npos)
+            if (const auto value = m_symbols.find(symbol))
             {
-                m_symbolToValue[symbol] = m_nextAvailableVariable;
-                result.bin = m_nextAvailableVariable++;
+                result.bin = *value;
             }
             else
             {
-                unsigned long val;
-                char opener;
-                ss >> opener;
-                if (ss >> val)
-                    result.bin = val;
+                unsigned long val{};
+                const auto [numberEnd, numberError] = std::from_chars(symbol.data(), symbol.data() + symbol.size(), val);
+                if (symbol.find_first_not_of("0123456789") == std::string_view::npos && numberError == std::errc{})
+                    result.bin = static_cast<uint16_t>(val);
                 else
                 {
-                    m_symbolToValue[symbol] = m_nextAvailableVariable;
-                    result.bin = m_nextAvailableVariable++;
+                    // A variable, or in single pass mode possibly a label defined further down
+                    result.symbol = symbol;
+                    result.unresolved = true;
                 }
             }
-            result.bin[15] = false;
+            result.bin &= 0x7FFF;
             result.valid = true;
         }
         else if (firstChar)
         {
             // C Instruction
-            result.bin[15] = true;
-            result.bin[14] = true;
-            result.bin[13] = true;
+            result.bin = cInstructionBits;
 
             auto destEnd = lineString.find('=');
             auto compEnd = lineString.find(';');
-            if (destEnd == std::string::npos) destEnd = 0;
-            const bool hasJump{ compEnd != std::string::npos };
+            if (destEnd == std::string_view::npos) destEnd = 0;
+            const bool hasJump{ compEnd != std::string_view::npos };
+            const size_t compStart = destEnd ? destEnd + 1 : 0;
 
-            std::string dest = lineString.substr(0, destEnd);
-            std::string comp = lineString.substr(destEnd ? destEnd + 1 : 0, compEnd);
-            std::string jump = hasJump ? lineString.substr(compEnd + 1) : "";
+            std::string_view dest = lineString.substr(0, destEnd);
+            std::string_view comp = lineString.substr(compStart, hasJump ? compEnd - compStart : std::string_view::npos);
+            std::string_view jump = hasJump ? lineString.substr(compEnd + 1) : std::string_view{};
 
             if (jump.size())
             {
-                const auto jumpIterator = jumpMap.find(jump);
-                if (jumpIterator != jumpMap.end())
-                    setBits(result.bin, 0, jumpIterator->second);
+                if (const auto bits = jumpBits(jump))
+                    result.bin |= *bits;
                 else
                     result.error = "Invalid jump";
             }
             if (dest.size())
             {
-                const auto destIterator = destMap.find(dest);
-                if (destIterator != destMap.end())
-                    setBits(result.bin, 3, destIterator->second);
+                if (const auto bits = destBits(dest))
+                    result.bin |= *bits;
                 else
                 {
                     result.error = "Invalid destination";
@@ -133,11 +148,8 @@ namespace Assembler
             }
             if (comp.size())
             {
-                if (comp.find('M') != std::string::npos) result.bin[12] = true;
-                else result.bin[12] = false;
-                const auto compIterator = compMap.find(comp);
-                if (compIterator != compMap.end())
-                    setBits(result.bin, 6, compIterator->second);
+                if (const auto bits = compBits(comp))
+                    result.bin |= *bits;
                 else
                 {
                     result.error = "Invalid computation";
@@ -148,54 +160,127 @@ namespace Assembler
         return result;
     }
 
-    int Assembler::parse(const fs::path& inputFile)
+    fs::path Assembler::outputPath(const fs::path& inputFile) const
     {
         fs::path outputFile{ inputFile };
-        outputFile.replace_extension("hack");
+        outputFile.replace_extension(m_options.format == OutputFormat::Binary ? "bin" : "hack");
+        return outputFile;
+    }
+
+    int Assembler::parse(const fs::path& inputFile)
+    {
+        const fs::path outputFile{ outputPath(inputFile) };
 
-        // Open input
-        std::ifstream input{ inputFile.fullFileName() };
-        if (!input)
+        // Map input, lines are handed out as slices of the mapping
+        Utilities::MappedFile input{ inputFile.fullFileName() };
+        if (!input.isOpen())
         {
             std::cout << "Unable to open Input File\n";
             return 1;
         }
         std::cout << "Assembling " << inputFile.fullFileName() << "\nOutputting to " << outputFile.fullFileName() << '\n';
 
+        reset();
+        if (!assembleSource(input.view()))
+        {
+            for (const auto& diagnostic : m_diagnostics)
+                std::cout << "Error Ln-" << diagnostic.line << " : " << diagnostic.message << '\n';
+            return 1;
+        }
+
+        std::string_view text{ input.view() };
+        while (!text.empty())
+        {
+            const auto lineString = Utilities::nextLine(text);
+            if (!lineString.empty())
+                std::cout << lineString << '\n';
+        }
+        return write(outputFile.fullFileName());
+    }
+
+    AssemblyResult Assembler::assembleFile(const fs::path& inputFile)
+    {
+        AssemblyResult result;
+        Utilities::MappedFile input{ inputFile.fullFileName() };
+        if (!input.isOpen())
+        {
+            result.diagnostics.push_back({ 0, "Unable to open Input File" });
+            return result;
+        }
+        reset();
+        if (assembleSource(input.view()) && !writeOutput(outputPath(inputFile).fullFileName()))
+            m_diagnostics.push_back({ 0, "Unable to open output file for writing" });
+        result.words = std::move(m_resultLines);
+        result.diagnostics = std::move(m_diagnostics);
+        if (!result.diagnostics.empty())
+            result.words.clear();
+        reset();
+        return result;
+    }
+
+    AssemblyResult Assembler::assemble(std::string_view source)
+    {
+        reset();
+        assembleSource(source);
+        AssemblyResult result{ std::move(m_resultLines), std::move(m_diagnostics) };
+        if (!result.diagnostics.empty())
+            result.words.clear();
+        reset();
+        return result;
+    }
+
+    bool Assembler::assembleSource(std::string_view source)
+    {
         // First Pass
-        std::string lineString;
-        unsigned long lineNumber{ 1 };
+        std::string_view text{ source };
+        std::string_view lineString;
         unsigned long symbolLine{ 0 };
-        while (input)
+        const bool parallel{ !m_options.singlePass && m_options.threads != 1 };
+        std::vector<std::string_view> codeLines;
+        while (!text.empty() && !m_options.singlePass)
         {
-            std::getline(input >> std::ws, lineString);
+            lineString = Utilities::nextLine(text);
             std::string error = parseSymbolLine(lineString, symbolLine);
             if (!error.empty())
-            {
-                std::cout << "Error Ln-" << lineNumber << '\n';
-                return 1;
-            }
-            lineNumber++;
+                addDiagnostic(source, lineString, error);
+            if (parallel && !lineString.empty())
+                codeLines.push_back(lineString);
         }
+        if (!m_diagnostics.empty())
+            return false;
 
-        // Second Pass
-        input.clear();
-        input.seekg(0);
-        lineNumber = 1;
-        while (input)
+        if (parallel)
+            return parseCodeLines(source, codeLines);
+
+        // Second Pass (the only pass in single pass mode)
+        text = source;
+        while (!text.empty())
         {
-            lineString.clear();
-            std::getline(input >> std::ws, lineString);
+            lineString = Utilities::nextLine(text);
             if (lineString.empty()) continue;
 
+            if (m_options.singlePass)
+            {
+                symbolLine = m_resultLines.size();
+                std::string error = parseSymbolLine(lineString, symbolLine);
+                if (!error.empty())
+                {
+                    addDiagnostic(source, lineString, error);
+                    continue;
+                }
+            }
+
             try
             {
                 auto result = parseCodeLine(lineString);
                 if (!result.error.empty())
                 {
-                    std::cout << "Error Ln-" << lineNumber << " : " << result.error << '\n';
-                    input.close();
-                    return 1;
+                    addDiagnostic(source, lineString, result.error);
+                }
+                else if (result.unresolved)
+                {
+                    m_fixups.push_back({ m_resultLines.size(), result.symbol });
+                    m_resultLines.push_back(result.bin);
                 }
                 else if (!result.symbol.empty())
                 {
@@ -207,38 +292,157 @@ namespace Assembler
             }
             catch (...)
             {
-                std::cout << "Error Parsing file\n";
-                break;
+                addDiagnostic(source, lineString, "Error Parsing line");
             }
-
-            std::cout << lineString << '\n';
-            ++lineNumber;
         }
 
-        input.close();
-        return write(outputFile.fullFileName());
+        if (!m_diagnostics.empty())
+            return false;
+        resolveFixups();
+        return true;
     }
 
-    int Assembler::write(const std::string& outputFile)
+    bool Assembler::parseCodeLines(std::string_view source, const std::vector<std::string_view>& lines)
     {
-        if (!m_resultLines.empty())
+        // Second pass over chunks of lines on a thread each. Encoding only reads the symbol table,
+        // variables are left as fixups and allocated afterwards in source order.
+        struct Chunk
+        {
+            size_t begin{}, end{};
+            std::vector<uint16_t> words;
+            std::vector<Fixup> fixups;
+            std::vector<std::pair<size_t, std::string>> errors;
+        };
+        const unsigned threads{ m_options.threads ? m_options.threads : std::max(1u, std::thread::hardware_concurrency()) };
+        const size_t chunkSize{ std::max<size_t>(1024, (lines.size() + threads * 4 - 1) / (threads * 4)) };
+        std::vector<Chunk> chunks((lines.size() + chunkSize - 1) / chunkSize);
+        for (size_t i = 0; i < chunks.size(); i++)
+        {
+            chunks[i].begin = i * chunkSize;
+            chunks[i].end = std::min(lines.size(), chunks[i].begin + chunkSize);
+        }
+
+        Utilities::parallelFor(chunks.size(), threads, [&](size_t index)
         {
-            std::ofstream outf{ outputFile };
-            if (outf)
+            Chunk& chunk = chunks[index];
+            chunk.words.reserve(chunk.end - chunk.begin);
+            for (size_t i = chunk.begin; i < chunk.end; i++)
             {
-                for (const auto line : m_resultLines)
-                    outf << line << '\n';
+                try
+                {
+                    const auto result = encodeLine(lines[i]);
+                    if (!result.error.empty())
+                        chunk.errors.emplace_back(i, result.error);
+                    else if (result.unresolved)
+                    {
+                        chunk.fixups.push_back({ chunk.words.size(), result.symbol });
+                        chunk.words.push_back(result.bin);
+                    }
+                    else if (result.symbol.empty() && result.valid)
+                        chunk.words.push_back(result.bin);
+                }
+                catch (...)
+                {
+                    chunk.errors.emplace_back(i, "Error Parsing line");
+                }
             }
-            else
+        });
+
+        for (const auto& chunk : chunks)
+        {
+            for (const auto& fixup : chunk.fixups)
+                m_fixups.push_back({ m_resultLines.size() + fixup.index, fixup.symbol });
+            m_resultLines.insert(m_resultLines.end(), chunk.words.begin(), chunk.words.end());
+            for (const auto& [line, error] : chunk.errors)
+                addDiagnostic(source, lines[line], error);
+        }
+        if (!m_diagnostics.empty())
+            return false;
+        resolveFixups();
+        return true;
+    }
+
+    void Assembler::addDiagnostic(std::string_view source, std::string_view line, std::string message)
+    {
+        // Lines are slices of the source, so their line number is one more than the newlines before them
+        const auto offset = static_cast<size_t>(line.data() - source.data());
+        const auto lineNumber = 1 + std::count(source.begin(), source.begin() + std::min(offset, source.size()), '\n');
+        m_diagnostics.push_back({ static_cast<unsigned long>(lineNumber), std::move(message) });
+    }
+
+    void Assembler::resolveFixups()
+    {
+        // Walk in source order so variables get the same addresses as in two pass mode
+        for (const auto& fixup : m_fixups)
+        {
+            auto value = m_symbols.find(fixup.symbol);
+            if (!value)
             {
-                std::cerr << "Unable to open output file for writing\n";
-                return 1;
+                value = static_cast<uint16_t>(m_nextAvailableVariable++);
+                m_symbols.insert(fixup.symbol, *value);
             }
+            m_resultLines[fixup.index] = *value & 0x7FFF;
         }
-        else
+        m_fixups.clear();
+    }
+
+    int Assembler::write(const std::string& outputFile)
+    {
+        if (m_resultLines.empty() && m_options.format == OutputFormat::Text)
         {
             std::cout << "Empty Assembly file\n";
+            return 0;
+        }
+        if (!writeOutput(outputFile))
+        {
+            std::cerr << "Unable to open output file for writing\n";
+            return 1;
         }
         return 0;
     }
+
+    bool Assembler::writeOutput(const std::string& outputFile) const
+    {
+        if (m_options.format == OutputFormat::Binary)
+            return writeBinary(outputFile);
+        if (m_resultLines.empty())
+            return true;
+
+        // Format everything into one buffer, 16 digits and a newline per word, and write it in one go
+        std::string text(m_resultLines.size() * 17, '\n');
+        char* out = text.data();
+        for (const auto line : m_resultLines)
+        {
+            std::memcpy(out, byteDigits[line >> 8].data(), 8);
+            std::memcpy(out + 8, byteDigits[line & 0xFF].data(), 8);
+            out += 17;
+        }
+        std::ofstream outf{ outputFile };
+        return static_cast<bool>(outf.write(text.data(), static_cast<std::streamsize>(text.size())));
+    }
+
+    bool Assembler::writeBinary(const std::string& outputFile) const
+    {
+        std::vector<char> image;
+        image.reserve(12 + m_resultLines.size() * 2);
+        const auto put16 = [&image](uint16_t value)
+        {
+            image.push_back(static_cast<char>(value & 0xFF));
+            image.push_back(static_cast<char>(value >> 8));
+        };
+        if (m_options.romHeader)
+        {
+            const uint32_t wordCount = static_cast<uint32_t>(m_resultLines.size());
+            image.insert(image.end(), std::begin(romMagic), std::end(romMagic));
+            put16(romVersion);
+            put16(0);
+            put16(static_cast<uint16_t>(wordCount & 0xFFFF));
+            put16(static_cast<uint16_t>(wordCount >> 16));
+        }
+        for (const auto word : m_resultLines)
+            put16(word);
+
+        std::ofstream outf{ outputFile, std::ios::binary };
+        return static_cast<bool>(outf.write(image.data(), static_cast<std::streamsize>(image.size())));
+    }
 }
\ No newline at end of file
@@ -2,113 +2,178 @@
 
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <sstream>
-#include <bitset>
-#include <map>
+#include <cstdint>
+#include <optional>
 #include <vector>
 
 #include "Utilities.h"
+#include "AssemblerSymbolTable.h"
 
 namespace Assembler
 {
-    const std::map<std::string, std::vector<bool>> compMap{
-        {"0",   { 0, 1, 0, 1, 0, 1, 0 }},
-        {"1",   { 1, 1, 1, 1, 1, 1, 0 }},
-        {"-1",  { 0, 1, 0, 1, 1, 1, 0 }},
-        {"D",   { 0, 0, 1, 1, 0, 0, 0 }},
-        {"A",   { 0, 0, 0, 0, 1, 1, 0 }},
-        {"!D",  { 1, 0, 1, 1, 0, 0, 0 }},
-        {"!A",  { 1, 0, 0, 0, 1, 1, 0 }},
-        {"-D",  { 1, 1, 1, 1, 0, 0, 0 }},
-        {"-A",  { 1, 1, 0, 0, 1, 1, 0 }},
-        {"D+1", { 1, 1, 1, 1, 1, 0, 0 }},
-        {"A+1", { 1, 1, 1, 0, 1, 1, 0 }},
-        {"D-1", { 0, 1, 1, 1, 0, 0, 0 }},
-        {"A-1", { 0, 1, 0, 0, 1, 1, 0 }},
-        {"D+A", { 0, 1, 0, 0, 0, 0, 0 }},
-        {"D-A", { 1, 1, 0, 0, 1, 0, 0 }},
-        {"A-D", { 1, 1, 1, 0, 0, 0, 0 }},
-        {"D&A", { 0, 0, 0, 0, 0, 0, 0 }},
-        {"D|A", { 1, 0, 1, 0, 1, 0, 0 }},
-        {"M",   { 0, 0, 0, 0, 1, 1, 1 }},
-        {"!M",  { 1, 0, 0, 0, 1, 1, 1 }},
-        {"-M",  { 1, 1, 0, 0, 1, 1, 1 }},
-        {"M+1", { 1, 1, 1, 0, 1, 1, 1 }},
-        {"M-1", { 0, 1, 0, 0, 1, 1, 1 }},
-        {"D+M", { 0, 1, 0, 0, 0, 0, 1 }},
-        {"D-M", { 1, 1, 0, 0, 1, 0, 1 }},
-        {"M-D", { 1, 1, 1, 0, 0, 0, 1 }},
-        {"D&M", { 0, 0, 0, 0, 0, 0, 1 }},
-        {"D|M", { 1, 0, 1, 0, 1, 0, 1 }}
-    };
-    const std::map<std::string, std::vector<bool>> destMap{
-        {"null", { 0, 0, 0 }},
-        {"M",    { 1, 0, 0 }},
-        {"D",    { 0, 1, 0 }},
-        {"MD",   { 1, 1, 0 }},
-        {"A",    { 0, 0, 1 }},
-        {"AM",   { 1, 0, 1 }},
-        {"AD",   { 0, 1, 1 }},
-        {"AMD",  { 1, 1, 1 }}
+    // Packs a mnemonic of up to three characters into a key usable as a case label
+    constexpr uint32_t mnemonicKey(std::string_view mnemonic)
+    {
+        if (mnemonic.size() > 3) return 0;
+        uint32_t key = static_cast<uint32_t>(mnemonic.size());
+        for (const char c : mnemonic)
+            key = (key << 8) | static_cast<unsigned char>(c);
+        return key;
+    }
+
+    // a c1 c2 c3 c4 c5 c6 placed in bits 12-6
+    constexpr uint16_t compField(uint16_t a, uint16_t c) { return static_cast<uint16_t>(a << 12 | c << 6); }
+
+    constexpr std::optional<uint16_t> compBits(std::string_view comp)
+    {
+        switch (mnemonicKey(comp))
+        {
+            case mnemonicKey("0"):   return compField(0, 0b101010);
+            case mnemonicKey("1"):   return compField(0, 0b111111);
+            case mnemonicKey("-1"):  return compField(0, 0b111010);
+            case mnemonicKey("D"):   return compField(0, 0b001100);
+            case mnemonicKey("A"):   return compField(0, 0b110000);
+            case mnemonicKey("!D"):  return compField(0, 0b001101);
+            case mnemonicKey("!A"):  return compField(0, 0b110001);
+            case mnemonicKey("-D"):  return compField(0, 0b001111);
+            case mnemonicKey("-A"):  return compField(0, 0b110011);
+            case mnemonicKey("D+1"): return compField(0, 0b011111);
+            case mnemonicKey("A+1"): return compField(0, 0b110111);
+            case mnemonicKey("D-1"): return compField(0, 0b001110);
+            case mnemonicKey("A-1"): return compField(0, 0b110010);
+            case mnemonicKey("D+A"): return compField(0, 0b000010);
+            case mnemonicKey("D-A"): return compField(0, 0b010011);
+            case mnemonicKey("A-D"): return compField(0, 0b000111);
+            case mnemonicKey("D&A"): return compField(0, 0b000000);
+            case mnemonicKey("D|A"): return compField(0, 0b010101);
+            case mnemonicKey("M"):   return compField(1, 0b110000);
+            case mnemonicKey("!M"):  return compField(1, 0b110001);
+            case mnemonicKey("-M"):  return compField(1, 0b110011);
+            case mnemonicKey("M+1"): return compField(1, 0b110111);
+            case mnemonicKey("M-1"): return compField(1, 0b110010);
+            case mnemonicKey("D+M"): return compField(1, 0b000010);
+            case mnemonicKey("D-M"): return compField(1, 0b010011);
+            case mnemonicKey("M-D"): return compField(1, 0b000111);
+            case mnemonicKey("D&M"): return compField(1, 0b000000);
+            case mnemonicKey("D|M"): return compField(1, 0b010101);
+            default: return std::nullopt;
+        }
+    }
+
+    // d1 d2 d3 (A D M) placed in bits 5-3
+    constexpr std::optional<uint16_t> destBits(std::string_view dest)
+    {
+        if (dest == "null") return 0;
+        switch (mnemonicKey(dest))
+        {
+            case mnemonicKey("M"):   return 0b001 << 3;
+            case mnemonicKey("D"):   return 0b010 << 3;
+            case mnemonicKey("MD"):  return 0b011 << 3;
+            case mnemonicKey("A"):   return 0b100 << 3;
+            case mnemonicKey("AM"):  return 0b101 << 3;
+            case mnemonicKey("AD"):  return 0b110 << 3;
+            case mnemonicKey("AMD"): return 0b111 << 3;
+            default: return std::nullopt;
+        }
+    }
+
+    // j1 j2 j3 (< = >) placed in bits 2-0
+    constexpr std::optional<uint16_t> jumpBits(std::string_view jump)
+    {
+        if (jump == "null") return 0;
+        switch (mnemonicKey(jump))
+        {
+            case mnemonicKey("JGT"): return 0b001;
+            case mnemonicKey("JEQ"): return 0b010;
+            case mnemonicKey("JGE"): return 0b011;
+            case mnemonicKey("JLT"): return 0b100;
+            case mnemonicKey("JNE"): return 0b101;
+            case mnemonicKey("JLE"): return 0b110;
+            case mnemonicKey("JMP"): return 0b111;
+            default: return std::nullopt;
+        }
+    }
+
+    constexpr uint16_t cInstructionBits{ 0b111 << 13 };
+
+    struct LineParseResult
+    {
+        uint16_t bin{};
+        std::string error{};
+        std::string_view symbol{};
+        bool valid{};
+        bool unresolved{}; // A instruction whose symbol is patched once the file ends
     };
-    const std::map<std::string, std::vector<bool>> jumpMap{
-        {"null", { 0, 0, 0 }},
-        {"JGT",  { 1, 0, 0 }},
-        {"JEQ",  { 0, 1, 0 }},
-        {"JGE",  { 1, 1, 0 }},
-        {"JLT",  { 0, 0, 1 }},
-        {"JNE",  { 1, 0, 1 }},
-        {"JLE",  { 0, 1, 1 }},
-        {"JMP",  { 1, 1, 1 }}
+
+    struct Diagnostic
+    {
+        unsigned long line{};
+        std::string message{};
     };
 
-    const std::map<std::string, std::bitset<16>> initSymbols{
-         {"R0",0}
-        ,{"R1",1}
-        ,{"R2",2}
-        ,{"R3",3}
-        ,{"R4",4}
-        ,{"R5",5}
-        ,{"R6",6}
-        ,{"R7",7}
-        ,{"R8",8}
-        ,{"R9",9}
-        ,{"R10",10}
-        ,{"R11",11}
-        ,{"R12",12}
-        ,{"R13",13}
-        ,{"R14",14}
-        ,{"R15",15}
-        ,{"SCREEN",16384}
-        ,{"KBD",24576}
-        ,{"SP",0}
-        ,{"LCL",1}
-        ,{"ARG",2}
-        ,{"THIS",3}
-        ,{"THAT",4}
+    struct AssemblyResult
+    {
+        std::vector<uint16_t> words;
+        std::vector<Diagnostic> diagnostics;
+        bool ok() const { return diagnostics.empty(); }
     };
 
-    struct LineParseResult
+    enum class OutputFormat { Text, Binary };
+
+    // Binary ROM images are the words in little endian order. With a header they are preceded by
+    // the magic "HACK", a uint16 format version, a uint16 reserved field and a uint32 word count.
+    constexpr char romMagic[4]{ 'H', 'A', 'C', 'K' };
+    constexpr uint16_t romVersion{ 1 };
+
+    struct Options
     {
-        std::bitset<16> bin{};
-        std::string error{}, symbol{};
-        bool valid{};
+        // Assemble in one read of the input, backpatching forward label references at the end
+        bool singlePass{};
+        OutputFormat format{ OutputFormat::Text };
+        bool romHeader{};
+        // Threads encoding the second pass, 0 for one per core. Single pass mode always uses one.
+        unsigned threads{ 1 };
     };
 
     class Assembler
     {
     public:
+        Assembler(Options options = {}) : m_options{ options }
+        {}
+
         int parse(const fs::path& inputFile);
+        // Assembles a whole program held in memory, without touching files or the console
+        AssemblyResult assemble(std::string_view source);
+        // Assembles inputFile next to itself, reporting problems only through the result
+        AssemblyResult assembleFile(const fs::path& inputFile);
         void reset();
-        std::string parseSymbolLine(const std::string& line, unsigned long& symbolLine);
-        LineParseResult parseCodeLine(const std::string& line);
+        std::string parseSymbolLine(std::string_view line, unsigned long& symbolLine);
+        LineParseResult parseCodeLine(std::string_view line);
     private:
         bool startswith(const std::string& str, const std::string& cmp);
-        void setBits(std::bitset<16>& bits, size_t start, const std::vector<bool>& values);
+        fs::path outputPath(const fs::path& inputFile) const;
         int write(const std::string& outputFile);
+        bool writeOutput(const std::string& outputFile) const;
+        bool writeBinary(const std::string& outputFile) const;
+        bool assembleSource(std::string_view source);
+        LineParseResult encodeLine(std::string_view line) const;
+        bool parseCodeLines(std::string_view source, const std::vector<std::string_view>& lines);
+        void resolveFixups();
+        void addDiagnostic(std::string_view source, std::string_view line, std::string message);
     private:
-        std::map<std::string, std::bitset<16>> m_symbolToValue{initSymbols};
+        struct Fixup
+        {
+            size_t index{};
+            std::string_view symbol{}; // Slice of the mapped input
+        };
+
+        Options m_options;
+        SymbolTable m_symbols;
         unsigned long m_nextAvailableVariable{16};
-        std::vector<std::bitset<16>> m_resultLines;
+        std::vector<uint16_t> m_resultLines;
+        std::vector<Fixup> m_fixups;
+        std::vector<Diagnostic> m_diagnostics;
     };
 }
\ No newline at end of file
@@ -0,0 +1,106 @@
+#include "AssemblerSymbolTable.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Assembler
+{
+    namespace
+    {
+        constexpr size_t initialSlots{ 1024 };
+        constexpr size_t arenaBlockSize{ 64 * 1024 };
+    }
+
+    SymbolTable::SymbolTable() : m_slots(initialSlots)
+    {}
+
+    size_t SymbolTable::hash(std::string_view symbol)
+    {
+        // FNV-1a
+        uint64_t result{ 14695981039346656037ull };
+        for (const char c : symbol)
+        {
+            result ^= static_cast<unsigned char>(c);
+            result *= 1099511628211ull;
+        }
+        return static_cast<size_t>(result ^ (result >> 32));
+    }
+
+    size_t SymbolTable::findSlot(std::string_view symbol) const
+    {
+        const size_t mask = m_slots.size() - 1;
+        size_t index = hash(symbol) & mask;
+        while (m_slots[index].used && m_slots[index].name != symbol)
+            index = (index + 1) & mask;
+        return index;
+    }
+
+    std::optional<uint16_t> SymbolTable::find(std::string_view symbol) const
+    {
+        if (const auto predefined = predefinedSymbol(symbol))
+            return predefined;
+        const Slot& slot = m_slots[findSlot(symbol)];
+        if (slot.used)
+            return slot.value;
+        return std::nullopt;
+    }
+
+    bool SymbolTable::insert(std::string_view symbol, uint16_t value)
+    {
+        if (predefinedSymbol(symbol))
+            return false;
+        size_t index = findSlot(symbol);
+        if (m_slots[index].used)
+            return false;
+        if ((m_size + 1) * 2 > m_slots.size())
+        {
+            grow();
+            index = findSlot(symbol);
+        }
+        m_slots[index] = { intern(symbol), value, true };
+        ++m_size;
+        return true;
+    }
+
+    void SymbolTable::clear()
+    {
+        std::fill(m_slots.begin(), m_slots.end(), Slot{});
+        m_size = 0;
+        m_currentBlock = 0;
+        m_blockUsed = 0;
+        m_largeNames.clear();
+    }
+
+    void SymbolTable::grow()
+    {
+        std::vector<Slot> oldSlots(m_slots.size() * 2);
+        oldSlots.swap(m_slots);
+        for (const auto& slot : oldSlots)
+        {
+            if (slot.used)
+                m_slots[findSlot(slot.name)] = slot;
+        }
+    }
+
+    std::string_view SymbolTable::intern(std::string_view symbol)
+    {
+        if (symbol.size() > arenaBlockSize)
+        {
+            m_largeNames.emplace_back(new char[symbol.size()]);
+            std::memcpy(m_largeNames.back().get(), symbol.data(), symbol.size());
+            return { m_largeNames.back().get(), symbol.size() };
+        }
+        if (m_blocks.empty() || m_blockUsed + symbol.size() > arenaBlockSize)
+        {
+            if (!m_blocks.empty())
+                ++m_currentBlock;
+            if (m_currentBlock == m_blocks.size())
+                m_blocks.emplace_back(new char[arenaBlockSize]);
+            m_blockUsed = 0;
+        }
+        char* name = m_blocks[m_currentBlock].get() + m_blockUsed;
+        std::memcpy(name, symbol.data(), symbol.size());
+        m_blockUsed += symbol.size();
+        return { name, symbol.size() };
+    }
+}
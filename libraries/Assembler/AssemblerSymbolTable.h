@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace Assembler
+{
+    // R0-R15, SP, LCL, ARG, THIS, THAT, SCREEN and KBD
+    constexpr std::optional<uint16_t> predefinedSymbol(std::string_view symbol)
+    {
+        if (symbol.size() == 2 && symbol[0] == 'R' && symbol[1] >= '0' && symbol[1] <= '9')
+            return static_cast<uint16_t>(symbol[1] - '0');
+        if (symbol.size() == 3 && symbol[0] == 'R' && symbol[1] == '1' && symbol[2] >= '0' && symbol[2] <= '5')
+            return static_cast<uint16_t>(10 + symbol[2] - '0');
+        switch (symbol.size())
+        {
+            case 2:
+                if (symbol == "SP") return 0;
+                break;
+            case 3:
+                if (symbol == "LCL") return 1;
+                if (symbol == "ARG") return 2;
+                if (symbol == "KBD") return 24576;
+                break;
+            case 4:
+                if (symbol == "THIS") return 3;
+                if (symbol == "THAT") return 4;
+                break;
+            case 6:
+                if (symbol == "SCREEN") return 16384;
+                break;
+        }
+        return std::nullopt;
+    }
+
+    // Labels and variables in an open addressing hash table. Names are interned in an arena that,
+    // like the table itself, keeps its memory across clear() so a reused Assembler does not reallocate.
+    class SymbolTable
+    {
+    public:
+        SymbolTable();
+        std::optional<uint16_t> find(std::string_view symbol) const;
+        // Returns false if the symbol is predefined or already in the table
+        bool insert(std::string_view symbol, uint16_t value);
+        void clear();
+        size_t size() const { return m_size; }
+    private:
+        struct Slot
+        {
+            std::string_view name{};
+            uint16_t value{};
+            bool used{};
+        };
+        static size_t hash(std::string_view symbol);
+        size_t findSlot(std::string_view symbol) const;
+        void grow();
+        std::string_view intern(std::string_view symbol);
+
+        std::vector<Slot> m_slots;
+        size_t m_size{};
+        std::vector<std::unique_ptr<char[]>> m_blocks;
+        size_t m_currentBlock{};
+        size_t m_blockUsed{};
+        std::vector<std::unique_ptr<char[]>> m_largeNames;
+    };
+}
@@ -0,0 +1,242 @@
+#include "Peephole.h"
+
+#include <sstream>
+
+namespace VMTranslator
+{
+    namespace
+    {
+        struct Line
+        {
+            std::string code{};
+            std::string comments{}; // Comment lines that preceded this instruction
+        };
+
+        bool isLabel(const std::string& code) { return !code.empty() && code[0] == '('; }
+        bool isAInstruction(const std::string& code) { return !code.empty() && code[0] == '@'; }
+        bool writesA(const std::string& code)
+        {
+            if (isAInstruction(code)) return true;
+            const auto destEnd = code.find('=');
+            return destEnd != std::string::npos && code.find('A') < destEnd;
+        }
+        bool isUnconditionalJump(const std::string& code) { return code == "0;JMP"; }
+
+        class Rewriter
+        {
+        public:
+            Rewriter(std::vector<Line>& lines) : m_lines{ lines } {}
+
+            bool run()
+            {
+                bool changed{};
+                for (size_t i = 0; i < m_lines.size(); i++)
+                {
+                    if (m_lines[i].code.empty()) continue;
+                    changed |= rewrite(i);
+                }
+                compact();
+                return changed;
+            }
+        private:
+            // Index of the n'th live line after i, or the size if there is none
+            size_t next(size_t i, int n = 1) const
+            {
+                while (n-- > 0)
+                {
+                    do { ++i; } while (i < m_lines.size() && m_lines[i].code.empty());
+                    if (i >= m_lines.size()) return m_lines.size();
+                }
+                return i;
+            }
+            bool matches(size_t i, std::initializer_list<const char*> codes) const
+            {
+                for (const auto code : codes)
+                {
+                    if (i >= m_lines.size() || m_lines[i].code != code) return false;
+                    i = next(i);
+                }
+                return true;
+            }
+            void erase(size_t i)
+            {
+                // Keep comments with the next surviving instruction
+                const size_t following = next(i);
+                if (following < m_lines.size())
+                    m_lines[following].comments.insert(0, m_lines[i].comments);
+                m_lines[i].code.clear();
+                m_lines[i].comments.clear();
+            }
+            void compact()
+            {
+                size_t out{};
+                for (size_t i = 0; i < m_lines.size(); i++)
+                {
+                    if (m_lines[i].code.empty()) continue;
+                    if (out != i)
+                        m_lines[out] = std::move(m_lines[i]);
+                    ++out;
+                }
+                m_lines.resize(out);
+            }
+
+            bool rewrite(size_t i)
+            {
+                const std::string& code = m_lines[i].code;
+                const size_t i1 = next(i), i2 = next(i, 2), i3 = next(i, 3);
+
+                // Push with a single SP access: @SP A=M M=D @SP M=M+1  ->  @SP M=M+1 A=M-1 M=D
+                if (matches(i, { "@SP", "A=M", "M=D", "@SP", "M=M+1" }))
+                {
+                    m_lines[i1].code = "M=M+1";
+                    m_lines[i2].code = "A=M-1";
+                    m_lines[i3].code = "M=D";
+                    erase(next(i3));
+                    return true;
+                }
+                // @SP M=M-1 A=M  ->  @SP AM=M-1
+                if (matches(i, { "@SP", "M=M-1", "A=M" }))
+                {
+                    m_lines[i1].code = "AM=M-1";
+                    erase(i2);
+                    return true;
+                }
+                // A push directly followed by a pop leaves SP where it was and the value in D:
+                // @SP M=M+1 A=M-1 M=D @SP AM=M-1 D=M  ->  @SP A=M
+                if (matches(i, { "@SP", "M=M+1", "A=M-1", "M=D", "@SP", "AM=M-1", "D=M" }))
+                {
+                    m_lines[i1].code = "A=M";
+                    for (size_t dead = next(i1), n = 0; n < 5; n++, dead = next(dead))
+                        erase(dead);
+                    return true;
+                }
+                // @SP M=M+1 @SP AM=M-1  ->  @SP A=M
+                if (matches(i, { "@SP", "M=M+1", "@SP", "AM=M-1" }))
+                {
+                    m_lines[i1].code = "A=M";
+                    erase(i2);
+                    erase(i3);
+                    return true;
+                }
+                // The slot just popped is above the stack, clearing it is a dead store:
+                // @SP AM=M-1 D=M M=0  ->  @SP AM=M-1 D=M
+                if (matches(i, { "@SP", "AM=M-1", "D=M", "M=0" }))
+                {
+                    erase(i3);
+                    return true;
+                }
+                // After a push A already addresses the top of the stack:
+                // @SP M=M+1 A=M-1 M=D @SP A=M-1  ->  @SP M=M+1 A=M-1 M=D
+                if (matches(i, { "@SP", "M=M+1", "A=M-1", "M=D", "@SP", "A=M-1" }))
+                {
+                    const size_t reload = next(i3);
+                    erase(next(reload));
+                    erase(reload);
+                    return true;
+                }
+                // M=D M=!M  ->  M=!D  and  M=D M=-M  ->  M=-D
+                if (code == "M=D" && i1 < m_lines.size() && (m_lines[i1].code == "M=!M" || m_lines[i1].code == "M=-M"))
+                {
+                    m_lines[i1].code = m_lines[i1].code == "M=!M" ? "M=!D" : "M=-D";
+                    erase(i);
+                    return true;
+                }
+                // A=M A=A-1  ->  A=M-1
+                if (code == "A=M" && i1 < m_lines.size() && m_lines[i1].code == "A=A-1")
+                {
+                    m_lines[i].code = "A=M-1";
+                    erase(i1);
+                    return true;
+                }
+                // M=D D=M  ->  M=D
+                if (code == "M=D" && i1 < m_lines.size() && m_lines[i1].code == "D=M")
+                {
+                    erase(i1);
+                    return true;
+                }
+                // M=M+1 M=M-1 cancel out
+                if (code == "M=M+1" && i1 < m_lines.size() && m_lines[i1].code == "M=M-1")
+                {
+                    erase(i);
+                    erase(i1);
+                    return true;
+                }
+                // Loading A only for the next instruction to overwrite it
+                if ((isAInstruction(code) || (code.compare(0, 2, "A=") == 0 && code.find(';') == std::string::npos)) && i1 < m_lines.size() && isAInstruction(m_lines[i1].code))
+                {
+                    erase(i);
+                    return true;
+                }
+                // @X <no write to A> @X  ->  drop the second load
+                if (isAInstruction(code) && i2 < m_lines.size() && m_lines[i2].code == code
+                    && !isLabel(m_lines[i1].code) && !writesA(m_lines[i1].code))
+                {
+                    erase(i2);
+                    return true;
+                }
+                // Jump to a label that immediately follows
+                if (isAInstruction(code) && i1 < m_lines.size() && isUnconditionalJump(m_lines[i1].code))
+                {
+                    const std::string target = '(' + code.substr(1) + ')';
+                    for (size_t label = i2; label < m_lines.size() && isLabel(m_lines[label].code); label = next(label))
+                    {
+                        if (m_lines[label].code == target)
+                        {
+                            erase(i);
+                            erase(i1);
+                            return true;
+                        }
+                    }
+                }
+                // Nothing after an unconditional jump is reachable until the next label
+                if (isUnconditionalJump(code))
+                {
+                    bool erased{};
+                    for (size_t dead = i1; dead < m_lines.size() && !isLabel(m_lines[dead].code); dead = next(dead))
+                    {
+                        erase(dead);
+                        erased = true;
+                    }
+                    return erased;
+                }
+                return false;
+            }
+
+            std::vector<Line>& m_lines;
+        };
+    }
+
+    std::vector<std::string> peephole(const std::vector<std::string>& assembly)
+    {
+        std::vector<Line> lines;
+        std::string comments;
+        for (const auto& chunk : assembly)
+        {
+            std::istringstream ss(chunk);
+            std::string code;
+            while (std::getline(ss, code))
+            {
+                if (code.empty()) continue;
+                if (code.compare(0, 2, "//") == 0)
+                    comments += code + '\n';
+                else
+                {
+                    lines.push_back({ code, comments });
+                    comments.clear();
+                }
+            }
+        }
+
+        Rewriter rewriter{ lines };
+        while (rewriter.run())
+        {}
+
+        std::vector<std::string> result;
+        result.reserve(lines.size());
+        for (auto& line : lines)
+            result.push_back(line.comments + line.code);
+        if (!comments.empty())
+            result.push_back(comments.substr(0, comments.size() - 1));
+        return result;
+    }
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace VMTranslator
+{
+    // Pattern based rewriting of the Hack assembly produced by the Translator. Takes the generated
+    // text, one instruction, label or comment per line, and returns it with redundant stack pointer
+    // traffic, dead stores and unreachable code removed. Comments are kept in front of the
+    // instruction that follows them.
+    std::vector<std::string> peephole(const std::vector<std::string>& assembly);
+}
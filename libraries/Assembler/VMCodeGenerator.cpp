@@ -0,0 +1,469 @@
+#include "VMCodeGenerator.h"
+
+#include <utility>
+
+namespace VMTranslator
+{
+    namespace
+    {
+        const std::string returnSequence{
+            "@LCL\nD=M\n@R13\nM=D\n" // LCL to temp (endFrame)
+            "@5\nD=A\n@LCL\nA=M-D\nD=M\n@R14\nM=D\n" // retAddr to temp
+            "@SP\nA=M-1\nD=M\n@ARG\nA=M\nM=D\n" // Move return value to arg0
+            "@ARG\nD=M+1\n@SP\nM=D\n" // Reposition SP
+            "@1\nD=A\n@R13\nA=M-D\nD=M\n@THAT\nM=D\n" // Restore caller THAT
+            "@2\nD=A\n@R13\nA=M-D\nD=M\n@THIS\nM=D\n" // Restore caller THIS
+            "@3\nD=A\n@R13\nA=M-D\nD=M\n@ARG\nM=D\n" // Restore caller ARG
+            "@4\nD=A\n@R13\nA=M-D\nD=M\n@LCL\nM=D\n" // Restore caller LCL
+            "@R14\nA=M\n0;JMP\n"
+        };
+
+        // Push D, the cached top of the stack, onto the stack in RAM
+        const std::string spillD{ "@SP\nM=M+1\nA=M-1\nM=D\n" };
+
+        // Shared call and return, jumped to by every call site and return when sharing them.
+        // $$CALL expects the callee in R13, 5 + numArgs in R15 and the return address in D.
+        const std::string sharedCallReturn{
+            "($$CALL)\n"
+            "@SP\nA=M\nM=D\n" // Push Return Address
+            "@LCL\nD=M\n@SP\nAM=M+1\nM=D\n" // save Caller state by pushing to stack
+            "@ARG\nD=M\n@SP\nAM=M+1\nM=D\n"
+            "@THIS\nD=M\n@SP\nAM=M+1\nM=D\n"
+            "@THAT\nD=M\n@SP\nAM=M+1\nM=D\n"
+            "@SP\nMD=M+1\n@LCL\nM=D\n" // set LCL to SP
+            "@R15\nD=D-M\n@ARG\nM=D\n" // set ARG to SP - 5 - numArgs
+            "@R13\nA=M\n0;JMP\n" // go to function
+            "($$RETURN)\n" + returnSequence
+        };
+
+        // Shared eq, gt and lt, jumped to with the return address in D. The address is kept in R15
+        // while the two operands are replaced by the result.
+        std::string sharedCompareStub(const std::string& name, const std::string& jump)
+        {
+            return "($$" + name + ")\n@R15\nM=D\n"
+                "@SP\nAM=M-1\nD=M\nA=A-1\nD=M-D\nM=-1\n" // Assume true
+                "@$$CMPEND\nD;" + jump + "\n@SP\nA=M-1\nM=0\n";
+        }
+        // Tail call, jumped to with the callee in D and numArgs in R13 in place of call f numArgs; return.
+        // The callee reuses the frame of the current function, so it returns straight to the caller: the
+        // new arguments are copied down over the current ones, upwards as the target is always below the
+        // source. When the argument counts differ, the saved frame (return address, LCL, ARG, THIS, THAT)
+        // has to move as well, so it is stashed just above the new arguments and copied down with them.
+        const std::string sharedTailCall{
+            "($$TAILCALL)\n@R14\nM=D\n"
+            "@SP\nD=M\n@R13\nD=D-M\n@R15\nM=D\n" // Copy from SP - numArgs
+            "@LCL\nD=M\n@ARG\nD=D-M\n@5\nD=D-A\n@R13\nD=D-M\n@$$TAILCALL.MOVE\nD;JNE\n"
+            "@R14\nD=M\n@SP\nA=M\nM=D\n" // Same count, callee just past the copied words
+            "@$$TAILCALL.START\n0;JMP\n"
+            "($$TAILCALL.MOVE)\n"
+            "@R14\nD=M\n@SP\nA=M+1\nA=A+1\nA=A+1\nA=A+1\nA=A+1\nM=D\n" // Callee past the stash
+            "@LCL\nD=M\n@5\nA=D-A\nD=M\n@SP\nA=M\nM=D\n" // Stash the frame at SP
+            "@LCL\nD=M\n@4\nA=D-A\nD=M\n@SP\nA=M+1\nM=D\n"
+            "@LCL\nD=M\n@3\nA=D-A\nD=M\n@SP\nA=M+1\nA=A+1\nM=D\n"
+            "@LCL\nD=M\n@2\nA=D-A\nD=M\n@SP\nA=M+1\nA=A+1\nA=A+1\nM=D\n"
+            "@LCL\nA=M-1\nD=M\n@SP\nA=M+1\nA=A+1\nA=A+1\nA=A+1\nM=D\n"
+            "@ARG\nD=M\n@R13\nD=D+M\n@5\nD=D+A\n@LCL\nM=D\n" // LCL follows the moved frame
+            "@5\nD=A\n@R13\nM=D+M\n"
+            "($$TAILCALL.START)\n@ARG\nD=M\n@R14\nM=D\n" // Copy to ARG
+            "($$TAILCALL.COPY)\n"
+            "@R13\nMD=M-1\n@$$TAILCALL.JUMP\nD;JLT\n"
+            "@R15\nAM=M+1\nA=A-1\nD=M\n@R14\nAM=M+1\nA=A-1\nM=D\n"
+            "@$$TAILCALL.COPY\n0;JMP\n"
+            "($$TAILCALL.JUMP)\n@R15\nA=M\nD=M\n@R13\nM=D\n"
+            "@LCL\nD=M\n@SP\nM=D\n"
+            "@R13\nA=M\n0;JMP\n"
+        };
+
+        const std::string sharedCompare{
+            sharedCompareStub("EQ", "JEQ") + "@$$CMPEND\n0;JMP\n"
+            + sharedCompareStub("GT", "JGT") + "@$$CMPEND\n0;JMP\n"
+            + sharedCompareStub("LT", "JLT")
+            + "($$CMPEND)\n@R15\nA=M\n0;JMP\n"
+        };
+    }
+
+    std::string segmentBase(Segment segment)
+    {
+        switch (segment)
+        {
+            case Segment::LOCAL: return "LCL";
+            case Segment::ARGUMENT: return "ARG";
+            case Segment::THIS: return "THIS";
+            case Segment::THAT: return "THAT";
+            default: return {};
+        }
+    }
+
+    std::string sharedRoutines(const Options& options)
+    {
+        std::string result;
+        if(options.sharedCallReturn)
+            result += "//Shared call and return\n" + sharedCallReturn;
+        if(options.sharedCompare)
+            result += "//Shared comparisons\n" + sharedCompare;
+        if(options.tailCalls)
+            result += "//Shared tail call\n" + sharedTailCall;
+        return result;
+    }
+
+    CodeGenerator::CodeGenerator(const Program& program, const Options& options, std::string labelNamespace, int firstId)
+        : m_program{ program }, m_options{ options }, m_namespace{ std::move(labelNamespace) }, m_id{ firstId }
+    {}
+
+    std::string CodeGenerator::newLabelId()
+    {
+        if (m_namespace.empty())
+            return "." + std::to_string(m_id++);
+        return "." + m_namespace + "." + std::to_string(m_id++);
+    }
+
+    std::vector<std::string> CodeGenerator::generate()
+    {
+        std::vector<std::string> result;
+        result.reserve(m_program.code.size());
+        bool cached{}; // Top of the stack is in D rather than RAM
+        for (size_t i = 0; i < m_program.code.size();)
+        {
+            std::string chunk;
+            size_t used = m_options.tailCalls ? generateTailCall(i, chunk) : 0;
+            if (used && cached)
+            {
+                chunk.insert(0, spillD);
+                cached = false;
+            }
+            if (!used && m_options.compareBranch)
+                used = generateBranch(i, chunk, cached);
+            if (!used && m_options.fuseMoves)
+            {
+                used = generateMove(i, chunk);
+                if (used && cached)
+                {
+                    chunk.insert(0, spillD);
+                    cached = false;
+                }
+            }
+            if (!used)
+            {
+                chunk = m_options.cacheTop ? generateCached(m_program.code[i], cached) : generate(m_program.code[i]);
+                used = 1;
+            }
+            result.push_back(std::move(chunk));
+            i += used;
+        }
+        if (cached)
+            result.push_back(spillD);
+        return result;
+    }
+
+    size_t CodeGenerator::generateTailCall(size_t i, std::string& result)
+    {
+        const auto& code = m_program.code;
+        if (code[i].op != Opcode::CALL || i + 1 >= code.size() || code[i + 1].op != Opcode::RETURN)
+            return 0;
+        result += "// " + m_program.toString(code[i]) + "\n// " + m_program.toString(code[i + 1]) + '\n';
+        result += '@' + std::to_string(code[i].arg) + "\nD=A\n@R13\nM=D\n@" + m_program.names[code[i].name] + "\nD=A\n@$$TAILCALL\n0;JMP\n";
+        return 2;
+    }
+
+    size_t CodeGenerator::generateBranch(size_t i, std::string& result, bool& cached)
+    {
+        const auto& code = m_program.code;
+        const auto opAt = [&](size_t n) { return i + n < code.size() ? code[i + n].op : Opcode::LABEL; };
+        const Opcode compare = opAt(0);
+        if (compare != Opcode::EQ && compare != Opcode::GT && compare != Opcode::LT) return 0;
+        const bool negate = opAt(1) == Opcode::NOT;
+        const size_t length = negate ? 3 : 2;
+        if (opAt(length - 1) != Opcode::IF_GOTO) return 0;
+
+        std::string jump;
+        switch (compare)
+        {
+            case Opcode::EQ: jump = negate ? "JNE" : "JEQ"; break;
+            case Opcode::GT: jump = negate ? "JLE" : "JGT"; break;
+            default: jump = negate ? "JGE" : "JLT"; break;
+        }
+        for (size_t n = 0; n < length; n++)
+            result += "// " + m_program.toString(code[i + n]) + '\n';
+        // Branch on x - y rather than building a boolean
+        if (!cached)
+            result += "@SP\nAM=M-1\nD=M\n";
+        cached = false;
+        result += "@SP\nAM=M-1\nD=M-D\n@" + m_program.names[code[i + length - 1].name] + "\nD;" + jump + '\n';
+        return length;
+    }
+
+    std::string CodeGenerator::generateCached(const Instruction& instruction, bool& cached)
+    {
+        std::string result = "// " + m_program.toString(instruction) + '\n';
+        // Make D the top of the stack
+        const auto fill = [&]() { if (!cached) result += "@SP\nAM=M-1\nD=M\n"; cached = true; };
+        switch (instruction.op)
+        {
+            case Opcode::PUSH:
+                if (cached) result += spillD;
+                result += loadD(instruction);
+                cached = true;
+                return result;
+            case Opcode::POP:
+            {
+                fill();
+                cached = false;
+                return result + storeD(instruction);
+            }
+            case Opcode::ADD: fill(); return result + "@SP\nAM=M-1\nD=D+M\n";
+            case Opcode::SUB: fill(); return result + "@SP\nAM=M-1\nD=M-D\n";
+            case Opcode::AND: fill(); return result + "@SP\nAM=M-1\nD=D&M\n";
+            case Opcode::OR: fill(); return result + "@SP\nAM=M-1\nD=D|M\n";
+            case Opcode::NEG:
+                result += cached ? "D=-D\n" : "@SP\nAM=M-1\nD=-M\n";
+                cached = true;
+                return result;
+            case Opcode::NOT:
+                result += cached ? "D=!D\n" : "@SP\nAM=M-1\nD=!M\n";
+                cached = true;
+                return result;
+            case Opcode::EQ:
+            case Opcode::GT:
+            case Opcode::LT:
+            {
+                if (m_options.sharedCompare)
+                    break;
+                fill();
+                const std::string name = instruction.op == Opcode::EQ ? "EQ" : instruction.op == Opcode::GT ? "GT" : "LT";
+                const std::string id = newLabelId();
+                return result + "@SP\nAM=M-1\nD=M-D\n@" + name + id + "\nD;J" + name + "\nD=0\n@" + name + "END" + id + "\n0;JMP\n"
+                    "(" + name + id + ")\nD=-1\n(" + name + "END" + id + ")\n";
+            }
+            case Opcode::IF_GOTO:
+                fill();
+                cached = false;
+                return result + '@' + m_program.names[instruction.name] + "\nD;JNE\n";
+            default:
+                break;
+        }
+        // Labels, branches, functions, calls and returns start from a stack held in RAM
+        if (cached) result += spillD;
+        cached = false;
+        return result + generate(instruction, false);
+    }
+
+    std::string CodeGenerator::address(const Instruction& instruction) const
+    {
+        std::string base;
+        switch (instruction.segment)
+        {
+            case Segment::STATIC: return '@' + m_program.names[instruction.name] + '.' + std::to_string(instruction.arg) + '\n';
+            case Segment::TEMP: return '@' + std::to_string(5 + instruction.arg) + '\n';
+            case Segment::POINTER: return instruction.arg == 0 ? "@THIS\n" : "@THAT\n";
+            case Segment::LOCAL: base = "@LCL\n"; break;
+            case Segment::ARGUMENT: base = "@ARG\n"; break;
+            case Segment::THIS: base = "@THIS\n"; break;
+            case Segment::THAT: base = "@THAT\n"; break;
+            default: return {};
+        }
+        if (instruction.arg > smallIndex) return {};
+        if (instruction.arg == 0) return base + "A=M\n";
+        base += "A=M+1\n";
+        for (int i = 1; i < instruction.arg; i++)
+            base += "A=A+1\n";
+        return base;
+    }
+
+    std::string CodeGenerator::loadD(const Instruction& push) const
+    {
+        if (push.segment == Segment::CONSTANT)
+            return '@' + std::to_string(push.arg) + "\nD=A\n";
+        const std::string direct = address(push);
+        if (!direct.empty())
+            return direct + "D=M\n";
+        return '@' + std::to_string(push.arg) + "\nD=A\n@" + segmentBase(push.segment) + "\nA=D+M\nD=M\n";
+    }
+
+    std::string CodeGenerator::storeD(const Instruction& pop) const
+    {
+        const std::string direct = address(pop);
+        if (!direct.empty())
+            return direct + "M=D\n";
+        // With the value v in R13 and v + address in D, A=D-M gives the address and M=D-A the value
+        return "@R13\nM=D\n@" + segmentBase(pop.segment) + "\nD=D+M\n@" + std::to_string(pop.arg) + "\nD=D+A\n@R13\nA=D-M\nM=D-A\n";
+    }
+
+    size_t CodeGenerator::generateMove(size_t i, std::string& result)
+    {
+        const auto& code = m_program.code;
+        const auto opAt = [&](size_t n) { return i + n < code.size() ? code[i + n].op : Opcode::LABEL; };
+        if (opAt(0) != Opcode::PUSH) return 0;
+
+        // push x pop y, push x neg|not pop y and push x push y add|sub|and|or pop z
+        size_t length{};
+        std::string compute;
+        if (opAt(1) == Opcode::POP)
+            length = 2;
+        else if ((opAt(1) == Opcode::NEG || opAt(1) == Opcode::NOT) && opAt(2) == Opcode::POP)
+        {
+            compute = opAt(1) == Opcode::NEG ? "D=-D\n" : "D=!D\n";
+            length = 3;
+        }
+        else if (opAt(1) == Opcode::PUSH && opAt(3) == Opcode::POP)
+        {
+            const Instruction& y = code[i + 1];
+            std::string operand;
+            if (y.segment == Segment::CONSTANT)
+                operand = '@' + std::to_string(y.arg) + "\n";
+            else
+                operand = address(y);
+            if (operand.empty()) return 0;
+            const char reg = y.segment == Segment::CONSTANT ? 'A' : 'M';
+            switch (opAt(2))
+            {
+                case Opcode::ADD: compute = operand + "D=D+" + reg + '\n'; break;
+                case Opcode::SUB: compute = operand + "D=D-" + reg + '\n'; break;
+                case Opcode::AND: compute = operand + "D=D&" + reg + '\n'; break;
+                case Opcode::OR: compute = operand + "D=D|" + reg + '\n'; break;
+                default: return 0;
+            }
+            length = 4;
+        }
+        else
+            return 0;
+
+        for (size_t n = 0; n < length; n++)
+            result += "// " + m_program.toString(code[i + n]) + '\n';
+        result += loadD(code[i]) + compute + storeD(code[i + length - 1]);
+        return length;
+    }
+
+    std::string CodeGenerator::generate(const Instruction& instruction, const bool addComment)
+    {
+        std::string result{};
+        if(addComment)
+            result += "// " + m_program.toString(instruction) + '\n';
+
+        const std::string index = std::to_string(instruction.arg);
+        switch (instruction.op)
+        {
+            case Opcode::PUSH:
+            {
+                const std::string valToD = '@' + index + "\nD=A\n";
+                // Set D to constant or located memory value
+                switch (instruction.segment)
+                {
+                    case Segment::CONSTANT: result += valToD; break;
+                    case Segment::LOCAL: result += valToD + "@LCL\nA=D+M\nD=M\n"; break;
+                    case Segment::ARGUMENT: result += valToD + "@ARG\nA=D+M\nD=M\n"; break;
+                    case Segment::THIS: result += valToD + "@THIS\nA=D+M\nD=M\n"; break;
+                    case Segment::THAT: result += valToD + "@THAT\nA=D+M\nD=M\n"; break;
+                    case Segment::STATIC: result += '@' + m_program.names[instruction.name] + '.' + index + "\nD=M\n"; break;
+                    case Segment::TEMP: result += '@' + std::to_string(5 + instruction.arg) + "\nD=M\n"; break;
+                    case Segment::POINTER: result += instruction.arg == 0 ? "@THIS\nD=M\n" : "@THAT\nD=M\n"; break;
+                    default: break;
+                }
+                // Add to stack and increment stack pointer
+                result += "@SP\nA=M\nM=D\n@SP\nM=M+1\n";
+                break;
+            }
+            case Opcode::POP:
+            {
+                result += "@SP\nAM=M-1\nD=M\n" + storeD(instruction);
+                break;
+            }
+            case Opcode::ADD: result += "@SP\nM=M-1\nA=M\nD=M\nM=0\nA=A-1\nM=D+M\n"; break;
+            case Opcode::SUB: result += "@SP\nM=M-1\nA=M\nD=M\nM=0\nA=A-1\nM=M-D\n"; break;
+            case Opcode::NEG: result += "@SP\nA=M-1\nM=-M\n"; break;
+            case Opcode::AND: result += "@SP\nAM=M-1\nD=M\nA=A-1\nM=D&M\n"; break;
+            case Opcode::OR: result += "@SP\nAM=M-1\nD=M\nA=A-1\nM=D|M\n"; break;
+            case Opcode::NOT: result += "@SP\nA=M-1\nM=!M\n"; break;
+            case Opcode::EQ:
+            case Opcode::GT:
+            case Opcode::LT:
+            {
+                const std::string name = instruction.op == Opcode::EQ ? "EQ" : instruction.op == Opcode::GT ? "GT" : "LT";
+                const std::string id = newLabelId();
+                if(m_options.sharedCompare)
+                {
+                    // One return label per site instead of a true and an end label
+                    result += "@" + name + id + "\nD=A\n@$$" + name + "\n0;JMP\n(" + name + id + ")\n";
+                    break;
+                }
+                result +=
+                    "@SP\nAM=M-1\nD=M\nM=0\nA=A-1\nD=M-D\n"
+                    "@" + name + id + "\nD;J" + name + "\n@SP\nA=M-1\nM=0\n"
+                    "@" + name + "END" + id + "\n0;JMP\n"
+                    "(" + name + id + ")\n@SP\nA=M-1\nM=-1\n"
+                    "(" + name + "END" + id + ")\n";
+                break;
+            }
+            case Opcode::LABEL: result += "(" + m_program.names[instruction.name] + ")\n"; break;
+            case Opcode::GOTO: result += "@" + m_program.names[instruction.name] + "\n0;JMP\n"; break;
+            case Opcode::IF_GOTO: result += "@SP\nAM=M-1\nD=M\n@" + m_program.names[instruction.name] + "\nD;JNE\n"; break;
+            case Opcode::FUNCTION:
+            {
+                const std::string& function = m_program.names[instruction.name];
+                const int numVars = instruction.arg;
+                result += "(" + function + ")\n";
+                if (numVars == 0)
+                    break;
+                if (m_options.localLoopThreshold > 0 && numVars >= m_options.localLoopThreshold)
+                {
+                    // Counted loop pushing a zero per local
+                    result += '@' + index + "\nD=A\n(" + function + "$LOCALS)\n@SP\nAM=M+1\nA=A-1\nM=0\n@" + function + "$LOCALS\nD=D-1;JGT\n";
+                }
+                else if (numVars <= 2)
+                {
+                    // Bump SP once per local, then clear the new slots from the top down
+                    result += "@SP\n";
+                    for (int i = 0; i < numVars; i++)
+                        result += "M=M+1\n";
+                    result += "A=M-1\nM=0\n";
+                    if (numVars == 2)
+                        result += "A=A-1\nM=0\n";
+                }
+                else
+                {
+                    result += "@SP\nA=M\nM=0\n";
+                    for (int i = 1; i < numVars; i++)
+                        result += "A=A+1\nM=0\n";
+                    result += "D=A+1\n@SP\nM=D\n";
+                }
+                break;
+            }
+            case Opcode::RETURN:
+                if(m_options.sharedCallReturn)
+                    result += "@$$RETURN\n0;JMP\n";
+                else
+                    result += returnSequence;
+                break;
+            case Opcode::CALL:
+            {
+                const std::string& function = m_program.names[instruction.name];
+                const std::string id = newLabelId();
+                if(m_options.sharedCallReturn)
+                {
+                    // Callee in R13, frame size + numArgs in R15, return address in D
+                    result += "@" + function + "\nD=A\n@R13\nM=D\n";
+                    result += "@" + std::to_string(5 + instruction.arg) + "\nD=A\n@R15\nM=D\n";
+                    result += "@RETURN" + id + "\nD=A\n@$$CALL\n0;JMP\n";
+                    result += "(RETURN" + id + ")\n";
+                    break;
+                }
+                // Push Return Address
+                result += "@RETURN" + id + "\n" + "D=A\n@SP\nA=M\nM=D\n@SP\nM=M+1\n";
+                // save Caller state by pushing to stack
+                result += "@LCL\nD=M\n@SP\nA=M\nM=D\n@SP\nM=M+1\n";
+                result += "@ARG\nD=M\n@SP\nA=M\nM=D\n@SP\nM=M+1\n";
+                result += "@THIS\nD=M\n@SP\nA=M\nM=D\n@SP\nM=M+1\n";
+                result += "@THAT\nD=M\n@SP\nA=M\nM=D\n@SP\nM=M+1\n";
+                // set ARG to SP - 5 - numArgs
+                result += "@5\nD=A\n@" + index + "\nD=D+A\n@SP\nD=M-D\n@ARG\nM=D\n";
+                // set LCL to previous caller SP
+                result += "@SP\nD=M\n@LCL\nM=D\n";
+                // go to function
+                result += "@" + function + "\n0;JMP\n";
+                // return address
+                result += "(RETURN" + id + ")\n";
+                break;
+            }
+        }
+        return result;
+    }
+}
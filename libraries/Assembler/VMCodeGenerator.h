@@ -0,0 +1,85 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "VMProgram.h"
+
+// Hack assembly generation for the VM instruction IR
+
+namespace VMTranslator
+{
+    struct Options
+    {
+        // Fold constant expressions in the VM code before generating assembly
+        bool foldConstants{};
+        // Replace calls to functions of at most this many commands that make no calls themselves with
+        // their bodies, 0 to never inline. Needs every file at once, so it is skipped when streaming.
+        int inlineThreshold{};
+        // Drop the functions Sys.init never calls, directly or indirectly. Needs every file at once,
+        // so it is skipped when streaming.
+        bool removeDeadFunctions{};
+        // Translate push/pop pairs and push/op/pop windows into moves through D
+        bool fuseMoves{};
+        // Keep the top of the stack in D between commands, spilling it at labels, branches and calls
+        bool cacheTop{};
+        // Translate eq|gt|lt [not] if-goto into a single conditional jump
+        bool compareBranch{};
+        // Clear locals with a counted loop in functions with at least this many, 0 to always unroll
+        int localLoopThreshold{};
+        // Run the peephole rewriter over the generated assembly before writing it
+        bool peephole{};
+        // Emit the call and return protocols once as $$CALL and $$RETURN and jump to them
+        bool sharedCallReturn{};
+        // Emit eq, gt and lt once as $$EQ, $$GT and $$LT and jump to them
+        bool sharedCompare{};
+        // Translate call f n; return into a jump to $$TAILCALL, which runs f in the current frame
+        bool tailCalls{};
+        // Files translated at once, 0 for one per core
+        unsigned threads{ 1 };
+        // Write the assembly of each batch of files as soon as it is generated rather than keeping the
+        // whole program until the end. The peephole rewriter then runs on one file at a time.
+        bool stream{};
+    };
+
+    // Highest local, argument, this or that index addressed by stepping A (A=M+1, A=A+1) rather than adding the index
+    constexpr int smallIndex{ 3 };
+    // Pointer register of local, argument, this and that
+    std::string segmentBase(Segment segment);
+    // Routines shared between call sites, emitted once after the bootstrap
+    std::string sharedRoutines(const Options& options);
+
+    // Generates the assembly for one program. Generated labels are numbered per generator and carry
+    // its label namespace, so programs generated apart from each other never clash.
+    class CodeGenerator
+    {
+    public:
+        CodeGenerator(const Program& program, const Options& options, std::string labelNamespace = {}, int firstId = 0);
+        // Assembly for the whole program, one chunk per command or fused window
+        std::vector<std::string> generate();
+        std::string generate(const Instruction& instruction, const bool addComment = true);
+        int nextId() const { return m_id; }
+
+    private:
+        std::string newLabelId();
+        // Tail call for a call; return pair at instruction i, returns the number of instructions it covers or 0
+        size_t generateTailCall(size_t i, std::string& result);
+        // Conditional jump for a compare [not] if-goto window at instruction i, returns the number of instructions it covers or 0
+        size_t generateBranch(size_t i, std::string& result, bool& cached);
+        // Code for instruction with the top of the stack in D when cached is set, updating cached
+        std::string generateCached(const Instruction& instruction, bool& cached);
+        // Fused code for the window starting at instruction i, returns the number of instructions it covers or 0
+        size_t generateMove(size_t i, std::string& result);
+        // Code leaving the address of a segment entry in A without using D, empty for large indices
+        std::string address(const Instruction& instruction) const;
+        // Code loading the value a push would push into D
+        std::string loadD(const Instruction& push) const;
+        // Code storing D where a pop would store it
+        std::string storeD(const Instruction& pop) const;
+
+        const Program& m_program;
+        Options m_options;
+        std::string m_namespace;
+        int m_id{};
+    };
+}
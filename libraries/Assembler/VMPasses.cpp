@@ -0,0 +1,355 @@
+#include "VMPasses.h"
+
+#include <algorithm>
+#include <optional>
+#include <unordered_map>
+
+namespace VMTranslator
+{
+    namespace
+    {
+        struct Constant
+        {
+            int16_t value{};
+            size_t length{}; // Instructions the constant takes at the end of the code
+        };
+
+        bool isPushConstant(const Instruction& instruction)
+        {
+            return instruction.op == Opcode::PUSH && instruction.segment == Segment::CONSTANT;
+        }
+
+        // The constant computed by the last instructions: push constant c, optionally followed by a neg or not
+        std::optional<Constant> constantAt(const std::vector<Instruction>& code, size_t end)
+        {
+            if (end >= 1 && isPushConstant(code[end - 1]))
+                return Constant{ static_cast<int16_t>(code[end - 1].arg), 1 };
+            if (end >= 2 && isPushConstant(code[end - 2]))
+            {
+                const auto value = static_cast<int16_t>(code[end - 2].arg);
+                if (code[end - 1].op == Opcode::NEG)
+                    return Constant{ static_cast<int16_t>(-value), 2 };
+                if (code[end - 1].op == Opcode::NOT)
+                    return Constant{ static_cast<int16_t>(~value), 2 };
+            }
+            return std::nullopt;
+        }
+
+        // push constant only takes 0-32767, negative values are pushed as not ~value
+        void pushConstant(std::vector<Instruction>& code, int16_t value)
+        {
+            if (value >= 0)
+                code.push_back({ Opcode::PUSH, Segment::CONSTANT, value });
+            else
+            {
+                code.push_back({ Opcode::PUSH, Segment::CONSTANT, static_cast<int16_t>(~value) });
+                code.push_back({ Opcode::NOT });
+            }
+        }
+
+        std::optional<int16_t> evaluate(Opcode op, int16_t x, int16_t y)
+        {
+            switch (op)
+            {
+                case Opcode::ADD: return static_cast<int16_t>(x + y);
+                case Opcode::SUB: return static_cast<int16_t>(x - y);
+                case Opcode::AND: return static_cast<int16_t>(x & y);
+                case Opcode::OR: return static_cast<int16_t>(x | y);
+                // The generated gt and lt test the sign of the wrapped x - y, so fold them the same way
+                case Opcode::EQ: return static_cast<int16_t>(x == y ? -1 : 0);
+                case Opcode::GT: return static_cast<int16_t>(static_cast<int16_t>(x - y) > 0 ? -1 : 0);
+                case Opcode::LT: return static_cast<int16_t>(static_cast<int16_t>(x - y) < 0 ? -1 : 0);
+                default: return std::nullopt;
+            }
+        }
+
+        // Append instruction to code, simplifying it against what is already there
+        void append(std::vector<Instruction>& code, const Instruction& instruction)
+        {
+            const Opcode op = instruction.op;
+            if (op == Opcode::NEG || op == Opcode::NOT)
+            {
+                if (const auto x = constantAt(code, code.size()))
+                {
+                    code.resize(code.size() - x->length);
+                    pushConstant(code, static_cast<int16_t>(op == Opcode::NEG ? -x->value : ~x->value));
+                    return;
+                }
+                // not not x and neg neg x are x
+                if (!code.empty() && code.back().op == op)
+                {
+                    code.pop_back();
+                    return;
+                }
+            }
+            else if (op == Opcode::IF_GOTO)
+            {
+                if (const auto x = constantAt(code, code.size()))
+                {
+                    code.resize(code.size() - x->length);
+                    if (x->value != 0)
+                        code.push_back({ Opcode::GOTO, Segment::NONE, 0, instruction.name });
+                    return;
+                }
+            }
+            else if (const auto y = constantAt(code, code.size()); y && evaluate(op, 0, 0))
+            {
+                if (const auto x = constantAt(code, code.size() - y->length))
+                {
+                    code.resize(code.size() - y->length - x->length);
+                    pushConstant(code, *evaluate(op, x->value, y->value));
+                    return;
+                }
+                // x + 0, x - 0, x | 0 and x & -1 are x
+                if (((op == Opcode::ADD || op == Opcode::SUB || op == Opcode::OR) && y->value == 0)
+                    || (op == Opcode::AND && y->value == -1))
+                {
+                    code.resize(code.size() - y->length);
+                    return;
+                }
+            }
+            code.push_back(instruction);
+        }
+
+        // A function body that can replace a call to it
+        struct InlineBody
+        {
+            const Program* program{};
+            std::string function;
+            std::vector<Instruction> code; // Without the function command and the final return
+            int locals{};
+            int arguments{}; // Arguments the body reads or writes, the call has to pass at least these
+            bool setsPointer[2]{};
+            bool earlyReturn{};
+        };
+
+        // The body of the function from begin up to end if it can be inlined: it makes no calls, ends in a
+        // return and every return leaves only its value on the stack, so a jump past the body can replace it
+        std::optional<InlineBody> inlineBody(const Program& program, size_t begin, size_t end, int threshold)
+        {
+            const auto& code = program.code;
+            if (static_cast<int>(end - begin - 1) > threshold || end - begin < 2 || code[end - 1].op != Opcode::RETURN)
+                return std::nullopt;
+            InlineBody body{ &program, program.names[code[begin].name], {}, code[begin].arg };
+            int depth = 0;
+            for (size_t i = begin + 1; i < end; i++)
+            {
+                const Instruction& instruction = code[i];
+                switch (instruction.op)
+                {
+                    case Opcode::CALL: return std::nullopt;
+                    case Opcode::PUSH: depth++; break;
+                    case Opcode::NEG:
+                    case Opcode::NOT: break;
+                    case Opcode::LABEL:
+                    case Opcode::GOTO:
+                        if (depth != 0) return std::nullopt;
+                        break;
+                    case Opcode::IF_GOTO:
+                        if (depth != 1) return std::nullopt;
+                        depth = 0;
+                        break;
+                    case Opcode::RETURN:
+                        if (depth != 1) return std::nullopt;
+                        depth = 0;
+                        body.earlyReturn = body.earlyReturn || i + 1 < end;
+                        break;
+                    default: depth--; break; // pop and the binary operations
+                }
+                if (depth < 0)
+                    return std::nullopt;
+                if (instruction.segment == Segment::ARGUMENT)
+                    body.arguments = std::max(body.arguments, instruction.arg + 1);
+                else if (instruction.segment == Segment::LOCAL && instruction.arg >= body.locals)
+                    return std::nullopt;
+                else if (instruction.segment == Segment::POINTER && instruction.op == Opcode::POP)
+                {
+                    if (instruction.arg < 0 || instruction.arg > 1) return std::nullopt;
+                    body.setsPointer[instruction.arg] = true;
+                }
+            }
+            body.code.assign(code.begin() + static_cast<std::ptrdiff_t>(begin) + 1, code.begin() + static_cast<std::ptrdiff_t>(end) - 1);
+            return body;
+        }
+
+        // Append body in place of a call passing arguments, with its arguments, locals and saved pointers in temp
+        void appendInlined(Program& program, std::vector<Instruction>& code, const InlineBody& body, int arguments, const std::vector<int>& temps, size_t site)
+        {
+            const auto temp = [&](size_t slot) { return Instruction{ Opcode::POP, Segment::TEMP, temps[slot] }; };
+            const auto push = [](Instruction instruction) { instruction.op = Opcode::PUSH; return instruction; };
+            const auto local = [&](int index) { return temp(static_cast<size_t>(arguments + index)); };
+            const std::string suffix = "$inline" + std::to_string(site);
+
+            for (int i = arguments; i-- > 0;)
+                code.push_back(temp(static_cast<size_t>(i)));
+            for (int i = 0; i < body.locals; i++)
+            {
+                code.push_back({ Opcode::PUSH, Segment::CONSTANT, 0 });
+                code.push_back(local(i));
+            }
+            size_t saved = static_cast<size_t>(arguments + body.locals);
+            for (int pointer = 0; pointer < 2; pointer++)
+            {
+                if (!body.setsPointer[pointer]) continue;
+                code.push_back({ Opcode::PUSH, Segment::POINTER, pointer });
+                code.push_back(temp(saved++));
+            }
+
+            const uint32_t end = body.earlyReturn ? program.intern(body.function + "$return" + suffix) : 0;
+            for (Instruction instruction : body.code)
+            {
+                if (instruction.segment == Segment::ARGUMENT)
+                    instruction = instruction.op == Opcode::PUSH ? push(temp(static_cast<size_t>(instruction.arg))) : temp(static_cast<size_t>(instruction.arg));
+                else if (instruction.segment == Segment::LOCAL)
+                    instruction = instruction.op == Opcode::PUSH ? push(local(instruction.arg)) : local(instruction.arg);
+                else if (instruction.segment == Segment::STATIC)
+                    instruction.name = program.intern(std::string{ body.program->names[instruction.name] }); // Keeps the callee's file
+                else if (instruction.op == Opcode::LABEL || instruction.op == Opcode::GOTO || instruction.op == Opcode::IF_GOTO)
+                    instruction.name = program.intern(body.program->names[instruction.name] + suffix);
+                else if (instruction.op == Opcode::RETURN)
+                    instruction = { Opcode::GOTO, Segment::NONE, 0, end };
+                code.push_back(instruction);
+            }
+            if (body.earlyReturn)
+                code.push_back({ Opcode::LABEL, Segment::NONE, 0, end });
+
+            for (int pointer = 2; pointer-- > 0;)
+            {
+                if (!body.setsPointer[pointer]) continue;
+                code.push_back(push(temp(--saved)));
+                code.push_back({ Opcode::POP, Segment::POINTER, pointer });
+            }
+        }
+    }
+
+    void foldConstants(Program& program)
+    {
+        // Folding can expose new constants (push 1, push 2, add, neg), so simplify against the
+        // already folded output rather than the input
+        std::vector<Instruction> folded;
+        folded.reserve(program.code.size());
+        for (const auto& instruction : program.code)
+            append(folded, instruction);
+        program.code = std::move(folded);
+    }
+
+    size_t removeDeadFunctions(const std::vector<Program*>& programs, const std::string& entry)
+    {
+        // A function runs from its function command up to the next one
+        struct Function
+        {
+            const Program* program{};
+            size_t begin{};
+            size_t end{};
+            bool live{};
+        };
+        std::unordered_map<std::string, Function> functions;
+        for (const Program* program : programs)
+        {
+            const auto& code = program->code;
+            for (size_t i = 0; i < code.size(); i++)
+            {
+                if (code[i].op != Opcode::FUNCTION)
+                    continue;
+                size_t end = i + 1;
+                while (end < code.size() && code[end].op != Opcode::FUNCTION)
+                    end++;
+                functions.try_emplace(program->names[code[i].name], Function{ program, i, end });
+                i = end - 1;
+            }
+        }
+
+        const auto root = functions.find(entry);
+        if (root == functions.end())
+            return 0;
+        root->second.live = true;
+        std::vector<const Function*> pending{ &root->second };
+        while (!pending.empty())
+        {
+            const Function* function = pending.back();
+            pending.pop_back();
+            for (size_t i = function->begin; i < function->end; i++)
+            {
+                const Instruction& instruction = function->program->code[i];
+                if (instruction.op != Opcode::CALL)
+                    continue;
+                const auto callee = functions.find(function->program->names[instruction.name]);
+                if (callee != functions.end() && !callee->second.live)
+                {
+                    callee->second.live = true;
+                    pending.push_back(&callee->second);
+                }
+            }
+        }
+
+        size_t dropped = 0;
+        for (Program* program : programs)
+        {
+            auto& code = program->code;
+            size_t kept = 0;
+            bool live = true; // Code ahead of the first function is kept
+            for (size_t i = 0; i < code.size(); i++)
+            {
+                if (code[i].op == Opcode::FUNCTION)
+                {
+                    live = functions.at(program->names[code[i].name]).live;
+                    if (!live)
+                        dropped++;
+                }
+                if (live)
+                    code[kept++] = code[i];
+            }
+            code.resize(kept);
+        }
+        return dropped;
+    }
+
+    size_t inlineFunctions(const std::vector<Program*>& programs, int threshold)
+    {
+        if (threshold <= 0)
+            return 0;
+        // Inlined arguments and locals live in the temp entries no code uses. Inlined bodies make no
+        // calls, so every call site can use the same entries.
+        bool tempUsed[8]{};
+        std::unordered_map<std::string, InlineBody> bodies;
+        for (const Program* program : programs)
+        {
+            const auto& code = program->code;
+            for (size_t i = 0; i < code.size(); i++)
+            {
+                if (code[i].segment == Segment::TEMP && code[i].arg >= 0 && code[i].arg < 8)
+                    tempUsed[code[i].arg] = true;
+                if (code[i].op != Opcode::FUNCTION)
+                    continue;
+                size_t end = i + 1;
+                while (end < code.size() && code[end].op != Opcode::FUNCTION)
+                    end++;
+                if (auto body = inlineBody(*program, i, end, threshold))
+                    bodies.try_emplace(body->function, std::move(*body));
+            }
+        }
+        std::vector<int> temps;
+        for (int i = 0; i < 8; i++)
+            if (!tempUsed[i]) temps.push_back(i);
+
+        size_t inlined = 0;
+        for (Program* program : programs)
+        {
+            std::vector<Instruction> code;
+            code.reserve(program->code.size());
+            for (const auto& instruction : program->code)
+            {
+                const auto body = instruction.op == Opcode::CALL ? bodies.find(program->names[instruction.name]) : bodies.end();
+                if (body == bodies.end() || body->second.arguments > instruction.arg
+                    || static_cast<size_t>(instruction.arg + body->second.locals + body->second.setsPointer[0] + body->second.setsPointer[1]) > temps.size())
+                {
+                    code.push_back(instruction);
+                    continue;
+                }
+                appendInlined(*program, code, body->second, instruction.arg, temps, inlined++);
+            }
+            program->code = std::move(code);
+        }
+        return inlined;
+    }
+}
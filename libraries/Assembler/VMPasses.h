@@ -0,0 +1,20 @@
+#pragma once
+
+#include "VMProgram.h"
+
+// Optimisation passes over the VM instruction IR, run before code generation
+
+namespace VMTranslator
+{
+    // Evaluate arithmetic, comparisons and logic on constants, remove identities such as x + 0 and
+    // not not, and resolve if-goto on a constant condition
+    void foldConstants(Program& program);
+    // Drop the functions of the whole program, made of programs, that no chain of calls from entry
+    // reaches. Nothing is dropped when entry is not defined. Returns the number of functions dropped.
+    size_t removeDeadFunctions(const std::vector<Program*>& programs, const std::string& entry = "Sys.init");
+    // Replace calls to functions of at most threshold commands that make no calls of their own with
+    // their bodies. Arguments and locals move to temp entries the whole program leaves unused, pointer
+    // entries the body sets are restored afterwards and labels get a suffix per call site. Returns the
+    // number of calls inlined.
+    size_t inlineFunctions(const std::vector<Program*>& programs, int threshold);
+}
@@ -0,0 +1,201 @@
+#include "VMProgram.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <utility>
+
+namespace VMTranslator
+{
+    namespace
+    {
+        constexpr std::array<std::pair<std::string_view, Opcode>, 17> opcodes{ {
+            { "add", Opcode::ADD }, { "sub", Opcode::SUB }, { "neg", Opcode::NEG },
+            { "eq", Opcode::EQ }, { "gt", Opcode::GT }, { "lt", Opcode::LT },
+            { "and", Opcode::AND }, { "or", Opcode::OR }, { "not", Opcode::NOT },
+            { "push", Opcode::PUSH }, { "pop", Opcode::POP },
+            { "label", Opcode::LABEL }, { "goto", Opcode::GOTO }, { "if-goto", Opcode::IF_GOTO },
+            { "function", Opcode::FUNCTION }, { "call", Opcode::CALL }, { "return", Opcode::RETURN }
+        } };
+        constexpr std::array<std::pair<std::string_view, Segment>, 9> segments{ {
+            { "", Segment::NONE }, { "constant", Segment::CONSTANT }, { "local", Segment::LOCAL },
+            { "argument", Segment::ARGUMENT }, { "this", Segment::THIS }, { "that", Segment::THAT },
+            { "static", Segment::STATIC }, { "temp", Segment::TEMP }, { "pointer", Segment::POINTER }
+        } };
+
+        bool isSpace(char c) { return std::isspace(static_cast<unsigned char>(c)) != 0; }
+
+        // Split a line into at most three words, ignoring comments
+        size_t splitWords(std::string_view line, std::array<std::string_view, 3>& words)
+        {
+            line = line.substr(0, line.find("//"));
+            size_t count{};
+            size_t pos{};
+            while (count < words.size())
+            {
+                while (pos < line.size() && isSpace(line[pos])) ++pos;
+                if (pos == line.size()) break;
+                const size_t start = pos;
+                while (pos < line.size() && !isSpace(line[pos])) ++pos;
+                words[count++] = line.substr(start, pos - start);
+            }
+            return count;
+        }
+
+        bool toInt(std::string_view word, int32_t& value)
+        {
+            const auto result = std::from_chars(word.data(), word.data() + word.size(), value);
+            return result.ec == std::errc{} && result.ptr == word.data() + word.size() && value >= 0;
+        }
+    }
+
+    std::string_view opcodeName(Opcode op)
+    {
+        return opcodes[static_cast<size_t>(op)].first;
+    }
+
+    std::string_view segmentName(Segment segment)
+    {
+        return segments[static_cast<size_t>(segment)].first;
+    }
+
+    uint32_t Program::intern(std::string_view name)
+    {
+        const auto [it, inserted] = m_nameIndex.try_emplace(std::string{ name }, static_cast<uint32_t>(names.size()));
+        if (inserted)
+            names.emplace_back(name);
+        return it->second;
+    }
+
+    std::string Program::parseLine(std::string_view line, uint32_t file)
+    {
+        std::array<std::string_view, 3> words;
+        const size_t count = splitWords(line, words);
+        if (count == 0) return {};
+
+        Instruction instruction{};
+        const auto opcode = std::find_if(opcodes.begin(), opcodes.end(), [&](const auto& entry) { return entry.first == words[0]; });
+        if (opcode == opcodes.end())
+            return "Invalid command " + std::string{ words[0] };
+        instruction.op = opcode->second;
+
+        switch (instruction.op)
+        {
+            case Opcode::PUSH:
+            case Opcode::POP:
+            {
+                const std::string command = instruction.op == Opcode::PUSH ? "C_PUSH" : "C_POP";
+                if (count < 3)
+                    return command + ": Insufficient instructions";
+                const auto segment = std::find_if(segments.begin() + 1, segments.end(), [&](const auto& entry) { return entry.first == words[1]; });
+                if (segment == segments.end() || !toInt(words[2], instruction.arg))
+                    return command + ": Invalid instruction";
+                instruction.segment = segment->second;
+                if ((instruction.segment == Segment::CONSTANT && instruction.op == Opcode::POP)
+                    || (instruction.segment == Segment::POINTER && instruction.arg > 1))
+                    return command + ": Invalid instruction";
+                if (instruction.segment == Segment::STATIC)
+                    instruction.name = file;
+                break;
+            }
+            case Opcode::LABEL:
+            case Opcode::GOTO:
+            case Opcode::IF_GOTO:
+                if (count < 2)
+                    return "C_GOTO: Insufficient instructions";
+                instruction.name = intern(words[1]);
+                break;
+            case Opcode::FUNCTION:
+            case Opcode::CALL:
+                if (count < 3)
+                    return instruction.op == Opcode::FUNCTION ? "C_FUNCTION: Insufficient instructions" : "C_CALL: Insufficient instructions";
+                if (!toInt(words[2], instruction.arg))
+                    return instruction.op == Opcode::FUNCTION ? "C_FUNCTION: Invalid instruction" : "C_CALL: Invalid instruction";
+                instruction.name = intern(words[1]);
+                break;
+            default:
+                break;
+        }
+        code.push_back(instruction);
+        return {};
+    }
+
+    std::string Program::parse(std::string_view source, uint32_t file)
+    {
+        int lineNumber{ 1 };
+        while (!source.empty())
+        {
+            const size_t end = std::min(source.find('\n'), source.size());
+            std::string error = parseLine(source.substr(0, end), file);
+            if (!error.empty())
+                return "ln-" + std::to_string(lineNumber) + ": " + error;
+            source.remove_prefix(std::min(end + 1, source.size()));
+            ++lineNumber;
+        }
+        return {};
+    }
+
+    std::string Program::load(std::string_view bytecode, uint32_t file)
+    {
+        std::vector<std::string> unitNames;
+        std::vector<Instruction> unitCode;
+        std::string error = Utilities::readVMBytecode(bytecode, unitNames, unitCode);
+        if (!error.empty())
+            return error;
+
+        // Map the unit's string table onto the program's
+        std::vector<uint32_t> nameMap;
+        nameMap.reserve(unitNames.size());
+        for (const auto& name : unitNames)
+            nameMap.push_back(intern(name));
+        code.reserve(code.size() + unitCode.size());
+        for (size_t i = 0; i < unitCode.size(); i++)
+        {
+            Instruction instruction = unitCode[i];
+            if ((instruction.op == Opcode::PUSH || instruction.op == Opcode::POP)
+                && (instruction.segment == Segment::NONE
+                    || (instruction.segment == Segment::CONSTANT && instruction.op == Opcode::POP)
+                    || (instruction.segment == Segment::POINTER && instruction.arg > 1)))
+                return "Invalid instruction " + std::to_string(i);
+            if (instruction.segment == Segment::STATIC)
+                instruction.name = file;
+            else if (instruction.op == Opcode::LABEL || instruction.op == Opcode::GOTO || instruction.op == Opcode::IF_GOTO
+                || instruction.op == Opcode::FUNCTION || instruction.op == Opcode::CALL)
+                instruction.name = nameMap[instruction.name];
+            code.push_back(instruction);
+        }
+        return {};
+    }
+
+    std::string Program::toString(const Instruction& instruction) const
+    {
+        std::string result{ opcodeName(instruction.op) };
+        switch (instruction.op)
+        {
+            case Opcode::PUSH:
+            case Opcode::POP:
+                result += ' ' + std::string{ segmentName(instruction.segment) } + ' ' + std::to_string(instruction.arg);
+                break;
+            case Opcode::LABEL:
+            case Opcode::GOTO:
+            case Opcode::IF_GOTO:
+                result += ' ' + names[instruction.name];
+                break;
+            case Opcode::FUNCTION:
+            case Opcode::CALL:
+                result += ' ' + names[instruction.name] + ' ' + std::to_string(instruction.arg);
+                break;
+            default:
+                break;
+        }
+        return result;
+    }
+
+    void Program::clear()
+    {
+        code.clear();
+        names.clear();
+        m_nameIndex.clear();
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "VMBytecode.h"
+
+// Typed representation of Hack VM code, parsed once and shared by code generation and optimisation passes
+
+namespace VMTranslator
+{
+    // The IR shares its opcodes and layout with the binary bytecode format
+    using Opcode = Utilities::VMOpcode;
+    using Segment = Utilities::VMSegment;
+    // One VM command. name indexes Program::names: the label or function of branches, functions and
+    // calls, and the file a static segment belongs to. arg is the segment index, local count or argument count.
+    using Instruction = Utilities::VMInstruction;
+
+    std::string_view opcodeName(Opcode op);
+    std::string_view segmentName(Segment segment);
+
+    struct Program
+    {
+        std::vector<Instruction> code;
+        std::vector<std::string> names;
+
+        uint32_t intern(std::string_view name);
+        // Parse one line of VM code into code, blank and comment lines add nothing. Returns an error message
+        std::string parseLine(std::string_view line, uint32_t file);
+        // Parse every line of source, static segments belonging to file. Returns "ln-<line>: <error>" on failure
+        std::string parse(std::string_view source, uint32_t file);
+        // Append VM bytecode, static segments belonging to file. Returns an error message
+        std::string load(std::string_view bytecode, uint32_t file);
+        // The instruction as VM text
+        std::string toString(const Instruction& instruction) const;
+        void clear();
+    private:
+        std::unordered_map<std::string, uint32_t> m_nameIndex;
+    };
+}
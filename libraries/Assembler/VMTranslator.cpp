@@ -1,69 +1,16 @@
 #include "VMTranslator.h"
-#include "VMTranslator.h"
+
+#include <algorithm>
 #include <fstream>
-#include "VMTranslator.h"
+#include <iterator>
+#include <thread>
+
+#include "Peephole.h"
+#include "VMCodeGenerator.h"
+#include "VMPasses.h"
 
 namespace VMTranslator
 {
-    VMCommandType VMTranslator::Translator::commandType(const std::string& line)
-    {
-        if (line == "add"
-            || line == "sub"
-            || line == "neg"
-            || line == "eq"
-            || line == "gt"
-            || line == "lt"
-            || line == "and"
-            || line == "or"
-            || line == "not"
-            )
-        {
-            return VMCommandType::C_ARITHMETIC;
-        }
-        else if(line == "pop")
-        {
-            return VMCommandType::C_POP;
-        }
-        else if(line == "push")
-        {
-            return VMCommandType::C_PUSH;
-        }
-        else if (line == "label" || line == "goto" || line == "if-goto")
-        {
-            return VMCommandType::C_GOTO;
-        }
-        else if (line == "function")
-        {
-            return VMCommandType::C_FUNCTION;
-        }
-        else if (line == "return")
-        {
-            return VMCommandType::C_RETURN;
-        }
-        else if (line == "call")
-        {
-            return VMCommandType::C_CALL;
-        }
-        return VMCommandType::INVALID;
-    }
-
-    std::string Translator::arg1(const std::string& line)
-    {
-        return std::string();
-    }
-
-    int Translator::arg2(const std::string& line)
-    {
-        try
-        {
-            return std::stoi(line);
-        }
-        catch(...)
-        {
-            return -1;
-        }
-    }
-
     int VMTranslator::Translator::parse(const std::vector<fs::path>& inputs)
     {
         if(inputs.empty())
@@ -74,250 +21,179 @@ namespace VMTranslator
 
         // Call Sys.init and set Stack pointer to 256
         if(inputs.size() > 1) init();
+        else if(m_options.sharedCallReturn || m_options.sharedCompare || m_options.tailCalls)
+            m_resultLines.push_back("@$$START\n0;JMP\n" + sharedRoutines(m_options) + "($$START)\n");
 
         std::cout << "Directory -> " << m_output.directory() << '\n';
         std::cout << "__________________________\n";
         std::cout << "| #\t| File\n";
         std::cout << "__________________________\n";
         for (size_t i = 0; i < inputs.size(); i++)
+            std::cout << "| " << std::to_string(i) + ":\t| " << inputs[i].filename() << '\n';
+
+        if (m_options.stream)
+            return stream(inputs);
+
+        const size_t first = m_units.size();
+        m_units.resize(first + inputs.size());
+        Utilities::parallelFor(inputs.size(), m_options.threads, [&](size_t i)
         {
-            // Open input
-            const fs::path& inputFile = inputs[i];
-            setCurrentFile(inputFile.filename());
-            std::ifstream inputStream{ inputFile.fullFileName() };
-            if (!inputStream)
+            m_units[first + i].error = readUnit(m_units[first + i], inputs[i]);
+        });
+        for (size_t i = first; i < m_units.size(); i++)
+        {
+            if (!m_units[i].error.empty())
             {
-                std::cerr << "Unable to open Input File\n";
+                std::cerr << m_units[i].file << ": " << m_units[i].error << '\n';
                 return 1;
             }
-            std::cout << "| " << std::to_string(i) + ":\t| " << inputFile.filename() << '\n';
-
-            int retval = parseUnit(inputStream);
-            inputStream.close();
-            if (retval) return retval;
         }
+        generate();
         std::cout << "__________________________\n";
         std::cout << "Writing to -> " << m_output.fullFileName() << '\n';
         return write(m_output.fullFileName());
     }
 
-    int Translator::parseUnit(std::istream& input)
+    int Translator::stream(const std::vector<fs::path>& inputs)
     {
-        std::string lineString;
-        int lineNumber{ 1 };
+        std::ofstream outf{ m_output.fullFileName() };
+        if (!outf)
+        {
+            std::cerr << "Unable to open output file for writing\n";
+            return 1;
+        }
+        std::cout << "__________________________\n";
+        std::cout << "Writing to -> " << m_output.fullFileName() << '\n';
+        Utilities::OutputBuffer output{ outf };
+        writeResult(output);
 
-        while (input)
+        // Only one batch of programs and their assembly is held at a time
+        const size_t batch = m_options.threads ? m_options.threads : std::max(1u, std::thread::hardware_concurrency());
+        for (size_t next = 0; next < inputs.size(); next += batch)
         {
-            std::getline(input >> std::ws, lineString);
-            const auto parsed = parseCodeLine(lineString);
-            const auto error = parsed.first;
-            const auto result = parsed.second;
-            if (!error.empty())
+            const size_t count = std::min(batch, inputs.size() - next);
+            const size_t first = m_units.size();
+            m_units.resize(first + count);
+            Utilities::parallelFor(count, m_options.threads, [&](size_t i)
             {
-                std::cerr << "ln-" + std::to_string(lineNumber) + ": " + error;
-                return 1;
-            }
-            if (!result.empty())
+                m_units[first + i].error = readUnit(m_units[first + i], inputs[next + i]);
+            });
+            for (size_t i = first; i < m_units.size(); i++)
             {
-                m_resultLines.push_back(result);
+                if (!m_units[i].error.empty())
+                {
+                    std::cerr << m_units[i].file << ": " << m_units[i].error << '\n';
+                    return 1;
+                }
             }
-            lineNumber++;
-            lineString.clear();
+            generate();
+            writeResult(output);
+        }
+        output.flush();
+        if (!outf)
+        {
+            std::cerr << "Unable to write output file\n";
+            return 1;
         }
         return 0;
     }
 
-    void VMTranslator::Translator::init()
+    std::string Translator::readUnit(Unit& unit, const fs::path& inputFile)
     {
-        const std::string result = "//Init\n@256\nD=A\n@SP\nM=D\n" + parseCodeLine("call Sys.init 0").second + "\n";
-        m_resultLines.push_back(result);
+        unit.file = inputFile.filename();
+        Utilities::MappedFile input{ inputFile.fullFileName() };
+        if (!input.isOpen())
+            return "Unable to open Input File";
+        const uint32_t file = unit.program.intern(unit.file);
+        if (inputFile.extension() == ".vmb")
+            return unit.program.load(input.view(), file);
+        return unit.program.parse(input.view(), file);
     }
 
-    std::pair<std::string, std::string> VMTranslator::Translator::parseCodeLine(const std::string& line, const bool addComment)
+    int Translator::parseUnit(std::istream& input)
     {
-        const auto codeLine = Utilities::trimComment(line);
-        const auto splitCode = Utilities::splitBySpace(codeLine);
-        if(codeLine.empty() || splitCode.empty()) return {};
-        std::string result{};
-        if(addComment)
-        {
-            result += "//";
-            for(const auto str : splitCode)
-                result += ' ' + str;
-            result += '\n';
-        }
+        const std::string source{ std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>() };
+        return parseUnit(source);
+    }
 
-        auto cmdType = commandType(splitCode[0]);
-        if(cmdType == VMCommandType::C_PUSH)
+    int Translator::parseUnit(std::string_view source)
+    {
+        Unit& unit = m_units.emplace_back();
+        unit.file = m_fileName;
+        const std::string error = unit.program.parse(source, unit.program.intern(unit.file));
+        if (!error.empty())
         {
-            if(splitCode.size() < 3)
-                return {"C_PUSH: Insufficient instructions", ""};
-
-            const std::string valToD = '@'+splitCode[2]+"\nD=A\n";
-            const std::string staticVal = '@'+m_fileName+'.'+splitCode[2]+'\n';
-            const std::string tempToA = '@'+std::to_string(5+std::stoi(splitCode[2]))+'\n';
-            // Set D to constant or located memory value
-            if(splitCode[1] == "constant")
-                result += valToD;
-            else if(splitCode[1] == "local")
-                result += valToD + "@LCL\nA=D+M\nD=M\n";
-            else if(splitCode[1] == "argument")
-                result += valToD + "@ARG\nA=D+M\nD=M\n";
-            else if(splitCode[1] == "this")
-                result += valToD + "@THIS\nA=D+M\nD=M\n";
-            else if(splitCode[1] == "that")
-                result += valToD + "@THAT\nA=D+M\nD=M\n";
-            else if(splitCode[1] == "static")
-                result += valToD + staticVal + "D=M\n";
-            else if(splitCode[1] == "temp")
-                result += tempToA + "D=M\n";
-            else if(splitCode[1] == "pointer" && splitCode[2] == "0")
-                result += "@THIS\nD=M\n";
-            else if(splitCode[1] == "pointer" && splitCode[2] == "1")
-                result += "@THAT\nD=M\n";
-            else
-                return {"C_POP: Invalid instruction", ""};
-            
-            // Add to stack and increment stack pointer
-            result += "@SP\nA=M\nM=D\n@SP\nM=M+1\n";
+            std::cerr << error << '\n';
+            m_units.pop_back();
+            return 1;
         }
-        else if(cmdType == VMCommandType::C_POP)
-        {
-            if(splitCode.size() < 3)
-                return {"C_POP: Insufficient instructions", ""};
+        return 0;
+    }
 
-            const std::string valToD = '@'+splitCode[2]+"\nD=A\n";
-            const std::string staticVal = '@'+m_fileName+'.'+splitCode[2]+'\n';
-            const std::string tempToA = '@'+std::to_string(5+std::stoi(splitCode[2]))+'\n';
-            const std::string decSP = "@SP\nM=M-1\n";
-            if(splitCode[1] == "local")
-                result += valToD + "@LCL\nM=D+M\n@SP\nAM=M-1\nD=M\n@LCL\nA=M\nM=D\n" + valToD + "@LCL\nM=M-D\n";
-            else if(splitCode[1] == "argument")
-                result += valToD + "@ARG\nM=D+M\n@SP\nAM=M-1\nD=M\n@ARG\nA=M\nM=D\n" + valToD + "@ARG\nM=M-D\n";
-            else if(splitCode[1] == "this")
-                result += valToD + "@THIS\nM=D+M\n@SP\nAM=M-1\nD=M\n@THIS\nA=M\nM=D\n" + valToD + "@THIS\nM=M-D\n";
-            else if(splitCode[1] == "that")
-                result += valToD + "@THAT\nM=D+M\n@SP\nAM=M-1\nD=M\n@THAT\nA=M\nM=D\n" + valToD + "@THAT\nM=M-D\n";
-            else if(splitCode[1] == "static")
-                result += "@SP\nAM=M-1\nD=M\n" + staticVal+"M=D\n";
-            else if(splitCode[1] == "pointer" && splitCode[2] == "0")
-                result += "@SP\nAM=M-1\nD=M\n@THIS\nM=D\n" ;
-            else if(splitCode[1] == "pointer" && splitCode[2] == "1")
-                result += "@SP\nAM=M-1\nD=M\n@THAT\nM=D\n";
-            else if(splitCode[1] == "temp")
-                result += "@SP\nAM=M-1\nD=M\n" + tempToA + "M=D\n";
-            else
-                return {"C_POP: Invalid instruction", ""};
-            //result += decSP;
-        }
-        else if(cmdType == VMCommandType::C_ARITHMETIC)
+    int Translator::loadUnit(std::string_view bytecode)
+    {
+        Unit& unit = m_units.emplace_back();
+        unit.file = m_fileName;
+        const std::string error = unit.program.load(bytecode, unit.program.intern(unit.file));
+        if (!error.empty())
         {
-            const std::string id = "."+ std::to_string(incID());
-            if(splitCode[0] == "add")
-                result += "@SP\nM=M-1\nA=M\nD=M\nM=0\nA=A-1\nM=D+M\n";
-            else if(splitCode[0] == "sub")
-                result += "@SP\nM=M-1\nA=M\nD=M\nM=0\nA=A-1\nM=M-D\n";
-            else if(splitCode[0] == "neg")
-                result += "@SP\nA=M-1\nM=-M\n";
-            else if (splitCode[0] == "eq")
-                result +=
-                "@SP\nAM=M-1\nD=M\nM=0\nA=A-1\nD=M-D\n"
-                "@EQ" + id +
-                "\nD;JEQ\n@SP\nA=M-1\nM=0\n"
-                "@EQEND" + id +
-                "\n0;JMP\n"
-                "(EQ" + id + ")"
-                "\n@SP\nA=M-1\nM=-1\n"
-                "(EQEND" + id + ")\n";
-            else if (splitCode[0] == "gt")
-                result +=
-                "@SP\nAM=M-1\nD=M\nM=0\nA=A-1\nD=M-D\n"
-                "@GT" + id +
-                "\nD;JGT\n@SP\nA=M-1\nM=0\n"
-                "@GTEND" + id +
-                "\n0;JMP\n"
-                "(GT" + id + ")"
-                "\n@SP\nA=M-1\nM=-1\n"
-                "(GTEND" + id + ")\n";
-            else if (splitCode[0] == "lt")
-                result +=
-                "@SP\nAM=M-1\nD=M\nM=0\nA=A-1\nD=M-D\n"
-                "@LT" + id +
-                "\nD;JLT\n@SP\nA=M-1\nM=0\n"
-                "@LTEND" + id +
-                "\n0;JMP\n"
-                "(LT" + id + ")"
-                "\n@SP\nA=M-1\nM=-1\n"
-                "(LTEND" + id + ")\n";
-            else if (splitCode[0] == "and")
-                result += "@SP\nAM=M-1\nD=M\nA=A-1\nM=D&M\n";
-            else if(splitCode[0] == "or" )
-                result += "@SP\nAM=M-1\nD=M\nA=A-1\nM=D|M\n";
-            else if(splitCode[0] == "not")
-                result += "@SP\nA=M-1\nM=!M\n";
-            else
-                return {"C_ARITHMETIC: Invalid instruction", ""};
+            std::cerr << error << '\n';
+            m_units.pop_back();
+            return 1;
         }
-        else if(cmdType == VMCommandType::C_GOTO)
-        {
-            if(splitCode.size() < 2)
-                return {"C_GOTO: Insufficient instructions", ""};
+        return 0;
+    }
 
-            if(splitCode[0] == "goto")
-                result += "@" + splitCode[1] + "\n0;JMP\n";
-            else if(splitCode[0] == "if-goto")
-                result += "@SP\nAM=M-1\nD=M\n@" + splitCode[1] + "\nD;JNE\n";
-            else if(splitCode[0] == "label")
-                result += "(" + splitCode[1] + ")\n";
-        }
-        else if(cmdType == VMCommandType::C_FUNCTION)
-        {
-            if (splitCode.size() < 3)
-                return { "C_FUNCTION: Insufficient instructions", "" };
+    void VMTranslator::Translator::init()
+    {
+        m_resultLines.push_back("//Init\n@256\nD=A\n@SP\nM=D\n" + parseCodeLine("call Sys.init 0").second + "\n" + sharedRoutines(m_options));
+    }
 
-            result += "(" + splitCode[1] + ")\n@SP\nA=M\n";
-            const int numVars = std::stoi(splitCode[2]);
-            for (int i = 0; i < numVars; i++)
-                result += "M=0\nA=A+1\n";
-            result += "D=A\n@SP\nM=D\n";
-        }
-        else if(cmdType == VMCommandType::C_RETURN)
-        {
-            result += "@LCL\nD=M\n@R13\nM=D\n"; // LCL to temp (endFrame)
-            result += "@5\nD=A\n@LCL\nA=M-D\nD=M\n@R14\nM=D\n"; // retAddr to temp
-            result += "@SP\nA=M-1\nD=M\n@ARG\nA=M\nM=D\n"; // Move return value to arg0
-            result += "@ARG\nD=M+1\n@SP\nM=D\n"; // Reposition SP
-            result += "@1\nD=A\n@R13\nA=M-D\nD=M\n@THAT\nM=D\n"; // Restore caller THAT
-            result += "@2\nD=A\n@R13\nA=M-D\nD=M\n@THIS\nM=D\n"; // Restore caller THIS
-            result += "@3\nD=A\n@R13\nA=M-D\nD=M\n@ARG\nM=D\n"; // Restore caller ARG
-            result += "@4\nD=A\n@R13\nA=M-D\nD=M\n@LCL\nM=D\n"; // Restore caller LCL
-            result += "@R14\nA=M\n0;JMP\n";
+    void Translator::generate()
+    {
+        if (!m_options.stream)
+        {
+            // Whole program passes, inlining first so functions it inlines everywhere can be dropped
+            std::vector<Program*> programs;
+            for (auto& unit : m_units)
+                programs.push_back(&unit.program);
+            if (const size_t inlined = inlineFunctions(programs, m_options.inlineThreshold))
+                std::cout << "Inlined " << inlined << " calls\n";
+            if (m_options.removeDeadFunctions)
+            {
+                if (const size_t dropped = removeDeadFunctions(programs))
+                    std::cout << "Removed " << dropped << " unused functions\n";
+            }
         }
-        else if(cmdType == VMCommandType::C_CALL)
-        {
-            if(splitCode.size() < 3)
-                return { "C_CALL: Insufficient instructions", "" };
 
-            const std::string id = "." + std::to_string(incID());
-            // Push Return Address
-            result += "@RETURN" + id + "\n" + "D=A\n@SP\nA=M\nM=D\n@SP\nM=M+1\n";
-            // save Caller state by pushing to stack
-            result += "@LCL\nD=M\n@SP\nA=M\nM=D\n@SP\nM=M+1\n";
-            result += "@ARG\nD=M\n@SP\nA=M\nM=D\n@SP\nM=M+1\n";
-            result += "@THIS\nD=M\n@SP\nA=M\nM=D\n@SP\nM=M+1\n";
-            result += "@THAT\nD=M\n@SP\nA=M\nM=D\n@SP\nM=M+1\n";
-            // set ARG to SP - 5 - numArgs
-            result += "@5\nD=A\n@" + splitCode[2] + "\nD=D+A\n@SP\nD=M-D\n@ARG\nM=D\n";
-            // set LCL to previous caller SP
-            //result += "@5\nD=A\n@SP\nD=M-D\n@LCL\nM=D\n";
-            result += "@SP\nD=M\n@LCL\nM=D\n";
-            // go to function
-            result += "@" + splitCode[1] + "\n0;JMP\n";
-            // return address
-            result += "(RETURN" + id + ")\n";
-        }
+        // Units are generated independently, so the result does not depend on the number of threads
+        std::vector<std::vector<std::string>> results(m_units.size());
+        Utilities::parallelFor(m_units.size(), m_options.threads, [&](size_t i)
+        {
+            Unit& unit = m_units[i];
+            if (m_options.foldConstants)
+                foldConstants(unit.program);
+            results[i] = CodeGenerator{ unit.program, m_options, unit.file }.generate();
+        });
+        size_t size = m_resultLines.size();
+        for (const auto& result : results)
+            size += result.size();
+        m_resultLines.reserve(size);
+        for (auto& result : results)
+            std::move(result.begin(), result.end(), std::back_inserter(m_resultLines));
+        m_units.clear();
+    }
 
-        return {"", result};
+    std::pair<std::string, std::string> VMTranslator::Translator::parseCodeLine(const std::string& line, const bool addComment)
+    {
+        Program program;
+        const std::string error = program.parseLine(line, program.intern(m_fileName));
+        if (!error.empty()) return { error, "" };
+        if (program.code.empty()) return {};
+        CodeGenerator generator{ program, m_options, {}, m_id };
+        std::string result = generator.generate(program.code.front(), addComment);
+        m_id = generator.nextId();
+        return { "", result };
     }
 
     int VMTranslator::Translator::write(const std::string& outputFile)
@@ -325,18 +201,13 @@ namespace VMTranslator
         if (!m_resultLines.empty())
         {
             std::ofstream outf{ outputFile };
-            if (outf)
-            {
-                for (const auto line : m_resultLines)
-                    outf << line << '\n';
-            }
-            else
+            if (!outf)
             {
-                outf.close();
                 std::cerr << "Unable to open output file for writing\n";
                 return 1;
             }
-            outf.close();
+            Utilities::OutputBuffer output{ outf };
+            writeResult(output);
         }
         else
         {
@@ -344,4 +215,16 @@ namespace VMTranslator
         }
         return 0;
     }
+
+    void Translator::writeResult(Utilities::OutputBuffer& output)
+    {
+        if (m_options.peephole)
+            m_resultLines = peephole(m_resultLines);
+        for (const auto& line : m_resultLines)
+        {
+            output.append(line);
+            output.append("\n");
+        }
+        m_resultLines.clear();
+    }
 }
\ No newline at end of file
@@ -4,42 +4,61 @@
 #include <vector>
 
 #include "Utilities.h"
+#include "VMCodeGenerator.h"
+#include "VMProgram.h"
 
 // Translate Hack.vm files to .asm
 
-enum class VMCommandType { C_ARITHMETIC, C_PUSH, C_POP, C_LABEL, C_GOTO, C_IF, C_FUNCTION, C_RETURN, C_CALL, INVALID };
 namespace VMTranslator
 {
     class Translator
     {
     public:
-        Translator(const fs::path output) : m_output{output}
+        Translator(const fs::path output, Options options = {}) : m_output{output}, m_options{options}
         {}
 
-        VMCommandType commandType(const std::string& line);
-
-        std::string arg1(const std::string& line);
-
-        int arg2(const std::string& line);
-
+        // Translate the inputs, each file on its own worker, into the output
         int parse(const std::vector<fs::path>& inputs);
+        // Parse VM code as a unit of the current file, code is generated for it by generate()
         int parseUnit(std::istream& input);
+        int parseUnit(std::string_view source);
+        // Load VM bytecode (.vmb) as a unit of the current file
+        int loadUnit(std::string_view bytecode);
+        // Parse and generate a single line on its own, returning {error, assembly}
         std::pair<std::string, std::string> parseCodeLine(const std::string& line, const bool addComment = true);
         void init();
+        // Generate the assembly for the parsed units, joined in the order they were added
+        void generate();
 
         int write(const std::string& outputFile);
         void reset()
         {
             m_resultLines.clear();
+            m_units.clear();
             m_id = 0;
         }
         int incID() { return m_id++; }
         void setCurrentFile(std::string file) { m_fileName = file; }
 
     private:
+        // The code of one file. Labels generated for it are namespaced by the file name.
+        struct Unit
+        {
+            std::string file;
+            Program program;
+            std::string error;
+        };
+        std::string readUnit(Unit& unit, const fs::path& inputFile);
+        // Read, generate and write the inputs a batch of files at a time
+        int stream(const std::vector<fs::path>& inputs);
+        // Append the generated lines to output and drop them
+        void writeResult(Utilities::OutputBuffer& output);
+
         std::vector<std::string> m_resultLines;
+        std::vector<Unit> m_units;
         std::string m_fileName;
         fs::path m_output;
+        Options m_options;
         int m_id{0};
     };
 }
\ No newline at end of file
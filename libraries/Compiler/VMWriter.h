@@ -3,6 +3,8 @@
 #include <vector>
 #include <map>
 
+#include "VMBytecode.h"
+
 namespace Compiler
 {
     enum class Segment { CONSTANT, ARG, LOCAL, STATIC, THIS, THAT, POINTER, TEMP };
@@ -12,40 +14,63 @@ namespace Compiler
     {
     public:
         VMWriter() : m_stream{ nullptr } {}
-        VMWriter(std::ostream* stream) : m_stream{ stream } {}
+        // In binary mode the commands are collected as VM bytecode and written by flush()
+        VMWriter(std::ostream* stream, bool binary = false) : m_stream{ stream }, m_binary{ binary } {}
         void writePush(Segment segment, int index)
         {
-            write("push " + segmentToString(segment) + " " + std::to_string(index));
+            if (m_binary) m_bytecode.add({ Utilities::VMOpcode::PUSH, segmentToBytecode(segment), index });
+            else write("push " + segmentToString(segment) + " " + std::to_string(index));
         }
         void writePop(Segment segment, int index)
         {
-            write("pop " + segmentToString(segment) + " " + std::to_string(index));
+            if (m_binary) m_bytecode.add({ Utilities::VMOpcode::POP, segmentToBytecode(segment), index });
+            else write("pop " + segmentToString(segment) + " " + std::to_string(index));
         }
         void writeArithmetic(Command command)
         {
-            write(commandToString(command));
+            if (m_binary) m_bytecode.add({ commandToBytecode(command) });
+            else write(commandToString(command));
         }
         void writeLabel(const std::string& label)
         {
-            write("label " + label);
+            if (m_binary) m_bytecode.add({ Utilities::VMOpcode::LABEL, Utilities::VMSegment::NONE, 0, m_bytecode.intern(label) });
+            else write("label " + label);
         }
         void writeGoto(const std::string& label)
         {
-            write("goto " + label);
+            if (m_binary) m_bytecode.add({ Utilities::VMOpcode::GOTO, Utilities::VMSegment::NONE, 0, m_bytecode.intern(label) });
+            else write("goto " + label);
         }
         void writeIf(const std::string& label)
         {
-            write("if-goto " + label);
+            if (m_binary) m_bytecode.add({ Utilities::VMOpcode::IF_GOTO, Utilities::VMSegment::NONE, 0, m_bytecode.intern(label) });
+            else write("if-goto " + label);
         }
         void writeCall(const std::string& name, int nArgs)
         {
-            write("call " + name + " " + std::to_string(nArgs));
+            if (m_binary) m_bytecode.add({ Utilities::VMOpcode::CALL, Utilities::VMSegment::NONE, nArgs, m_bytecode.intern(name) });
+            else write("call " + name + " " + std::to_string(nArgs));
         }
         void writeFunction(const std::string& name, int nLocals)
         {
-            write("function " + name + " " + std::to_string(nLocals));
+            if (m_binary) m_bytecode.add({ Utilities::VMOpcode::FUNCTION, Utilities::VMSegment::NONE, nLocals, m_bytecode.intern(name) });
+            else write("function " + name + " " + std::to_string(nLocals));
+        }
+        void writeReturn()
+        {
+            if (m_binary) m_bytecode.add({ Utilities::VMOpcode::RETURN });
+            else write("return");
+        }
+        // Write the collected bytecode to the stream in one go
+        void flush()
+        {
+            if (m_binary && m_stream)
+            {
+                const std::string data = m_bytecode.data();
+                m_stream->write(data.data(), static_cast<std::streamsize>(data.size()));
+                m_bytecode.clear();
+            }
         }
-        void writeReturn() { write("return"); }
 
         static std::string segmentToString(Segment segment)
         {
@@ -72,16 +97,49 @@ namespace Compiler
             else return "not";
         };
 
+        static Utilities::VMSegment segmentToBytecode(Segment segment)
+        {
+            switch (segment)
+            {
+                case Segment::CONSTANT: return Utilities::VMSegment::CONSTANT;
+                case Segment::ARG: return Utilities::VMSegment::ARGUMENT;
+                case Segment::LOCAL: return Utilities::VMSegment::LOCAL;
+                case Segment::STATIC: return Utilities::VMSegment::STATIC;
+                case Segment::THIS: return Utilities::VMSegment::THIS;
+                case Segment::THAT: return Utilities::VMSegment::THAT;
+                case Segment::POINTER: return Utilities::VMSegment::POINTER;
+                default: return Utilities::VMSegment::TEMP;
+            }
+        }
+        static Utilities::VMOpcode commandToBytecode(Command command)
+        {
+            switch (command)
+            {
+                case Command::ADD: return Utilities::VMOpcode::ADD;
+                case Command::SUB: return Utilities::VMOpcode::SUB;
+                case Command::NEG: return Utilities::VMOpcode::NEG;
+                case Command::GT: return Utilities::VMOpcode::GT;
+                case Command::LT: return Utilities::VMOpcode::LT;
+                case Command::AND: return Utilities::VMOpcode::AND;
+                case Command::OR: return Utilities::VMOpcode::OR;
+                case Command::EQ: return Utilities::VMOpcode::EQ;
+                default: return Utilities::VMOpcode::NOT;
+            }
+        }
+
         std::string newLabelId() { return std::to_string(m_labelIndex++); }
         void resetLabelIndex() { m_labelIndex = 0; }
         virtual void clear()
         {
             m_stream->clear();
+            m_bytecode.clear();
             m_labelIndex = 0;
         }
     private:
         virtual void write(const std::string line) { if (m_stream) *m_stream << line << '\n'; }
         std::ostream* m_stream{};
+        bool m_binary{};
+        Utilities::VMBytecodeWriter m_bytecode;
         int m_labelIndex{};
     };
 }
\ No newline at end of file
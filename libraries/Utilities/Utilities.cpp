@@ -1,17 +1,46 @@
 #include "Utilities.h"
 #include <iomanip>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+// Keep windows.h from defining min and max macros that break std::min and std::max
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace Utilities
 {
-    std::string trimSpaceAndComment(const std::string& line)
+    std::string_view trimSpaceAndComment(std::string_view line)
     {
-        std::string lineString = line.substr(0, line.find("//")); // Ignore everything after a comment
+        std::string_view lineString = line.substr(0, line.find("//")); // Ignore everything after a comment
         char const* skip_set{ " \t\n" };
         const auto endPos = lineString.find_first_of(skip_set);
-        if (endPos != std::string::npos)
+        if (endPos != std::string_view::npos)
             lineString = lineString.substr(0, endPos); // Trim trailing whitespace
         return lineString;
     }
+    std::string_view nextLine(std::string_view& text)
+    {
+        // Same as std::getline(input >> std::ws, line) but slicing instead of copying
+        size_t start{};
+        while (start < text.size() && std::isspace(static_cast<unsigned char>(text[start])))
+            ++start;
+        const size_t end = std::min(text.find('\n', start), text.size());
+        const std::string_view line = text.substr(start, end - start);
+        text.remove_prefix(std::min(end + 1, text.size()));
+        return line;
+    }
     std::string trimComment(const std::string& line)
     {
         auto timmedBlockComment = line.substr(0, line.find("/**"));
@@ -82,6 +111,130 @@ namespace Utilities
         }
         data.swap(buffer);
     }
+
+    void parallelFor(size_t count, unsigned jobs, const std::function<void(size_t)>& task)
+    {
+        if (jobs == 0)
+            jobs = std::max(1u, std::thread::hardware_concurrency());
+        const size_t threadCount = std::min<size_t>(jobs, count);
+        std::atomic<size_t> next{ 0 };
+        std::exception_ptr firstError;
+        std::mutex errorMutex;
+        const auto worker = [&]()
+        {
+            for (size_t i = next++; i < count; i = next++)
+            {
+                try
+                {
+                    task(i);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock{ errorMutex };
+                    if (!firstError) firstError = std::current_exception();
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < threadCount; i++)
+            threads.emplace_back(worker);
+        worker();
+        for (auto& thread : threads)
+            thread.join();
+        if (firstError)
+            std::rethrow_exception(firstError);
+    }
+
+    MappedFile::MappedFile(const std::string& fileName)
+    {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return;
+        LARGE_INTEGER fileSize{};
+        if (!GetFileSizeEx(file, &fileSize))
+        {
+            CloseHandle(file);
+            return;
+        }
+        if (fileSize.QuadPart > 0)
+        {
+            HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping)
+            {
+                m_data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+                m_size = m_data ? static_cast<size_t>(fileSize.QuadPart) : 0;
+                CloseHandle(mapping);
+            }
+            m_open = m_data != nullptr;
+        }
+        else
+        {
+            m_open = true; // Nothing to map in an empty file
+        }
+        CloseHandle(file);
+#else
+        const int file = open(fileName.c_str(), O_RDONLY);
+        if (file < 0)
+            return;
+        struct stat fileStat{};
+        if (fstat(file, &fileStat) != 0)
+        {
+            close(file);
+            return;
+        }
+        if (fileStat.st_size > 0)
+        {
+            void* data = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+            if (data != MAP_FAILED)
+            {
+                madvise(data, static_cast<size_t>(fileStat.st_size), MADV_SEQUENTIAL);
+                m_data = static_cast<const char*>(data);
+                m_size = static_cast<size_t>(fileStat.st_size);
+                m_open = true;
+            }
+        }
+        else
+        {
+            m_open = true; // Nothing to map in an empty file
+        }
+        close(file);
+#endif
+    }
+
+    MappedFile::~MappedFile()
+    {
+        if (!m_data)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(m_data);
+#else
+        munmap(const_cast<char*>(m_data), m_size);
+#endif
+    }
+
+    OutputBuffer::OutputBuffer(std::ostream& sink, size_t chunkSize) : m_sink{ sink }, m_chunkSize{ chunkSize }
+    {
+        m_chunk.reserve(m_chunkSize);
+    }
+
+    void OutputBuffer::append(std::string_view text)
+    {
+        if (m_chunk.size() + text.size() > m_chunkSize)
+            flush();
+        // Text that would not fit in a chunk on its own skips the copy
+        if (text.size() >= m_chunkSize)
+            m_sink.write(text.data(), static_cast<std::streamsize>(text.size()));
+        else
+            m_chunk.append(text);
+    }
+
+    void OutputBuffer::flush()
+    {
+        m_sink.write(m_chunk.data(), static_cast<std::streamsize>(m_chunk.size()));
+        m_chunk.clear(); // Keeps the capacity for the next chunk
+    }
 }
 
 namespace fs
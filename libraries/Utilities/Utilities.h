@@ -2,14 +2,51 @@
 
 #include <vector>
 #include <sstream>
+#include <string_view>
+#include <functional>
 
 namespace Utilities
 {
-    std::string trimSpaceAndComment(const std::string& line);
+    std::string_view trimSpaceAndComment(std::string_view line);
+    std::string_view nextLine(std::string_view& text);
     std::string trimComment(const std::string& line);
     std::vector<std::string> splitBySpace(const std::string& line);
     std::vector<std::string> splitBySpaceKeepQuoted(const std::string& line, bool includeQuotes = false);
     void xmlSanitise(std::string& data);
+    // Calls task(i) for every i in [0, count) on up to jobs threads (0 for one per core) and waits for all of them
+    void parallelFor(size_t count, unsigned jobs, const std::function<void(size_t)>& task);
+
+    // Read only view of a whole file, mapped into memory rather than copied
+    class MappedFile
+    {
+    public:
+        MappedFile(const std::string& fileName);
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator= (const MappedFile&) = delete;
+        ~MappedFile();
+        bool isOpen() const { return m_open; }
+        std::string_view view() const { return { m_data, m_size }; }
+    private:
+        const char* m_data{};
+        size_t m_size{};
+        bool m_open{};
+    };
+
+    // Collects small writes into one reusable chunk and passes it to the sink each time it fills up
+    class OutputBuffer
+    {
+    public:
+        OutputBuffer(std::ostream& sink, size_t chunkSize = 1 << 16);
+        OutputBuffer(const OutputBuffer&) = delete;
+        OutputBuffer& operator= (const OutputBuffer&) = delete;
+        ~OutputBuffer() { flush(); }
+        void append(std::string_view text);
+        void flush();
+    private:
+        std::ostream& m_sink;
+        std::string m_chunk;
+        size_t m_chunkSize;
+    };
 }
 
 namespace fs
@@ -0,0 +1,136 @@
+#include "VMBytecode.h"
+
+namespace Utilities
+{
+    namespace
+    {
+        void writeVarint(std::string& out, uint32_t value)
+        {
+            while (value >= 0x80)
+            {
+                out += static_cast<char>((value & 0x7F) | 0x80);
+                value >>= 7;
+            }
+            out += static_cast<char>(value);
+        }
+
+        bool readVarint(std::string_view& data, uint32_t& value)
+        {
+            value = 0;
+            for (unsigned shift = 0; shift < 35 && !data.empty(); shift += 7)
+            {
+                const auto byte = static_cast<uint8_t>(data.front());
+                data.remove_prefix(1);
+                value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+                if (!(byte & 0x80))
+                    return true;
+            }
+            return false;
+        }
+
+        bool hasName(VMOpcode op)
+        {
+            return op == VMOpcode::LABEL || op == VMOpcode::GOTO || op == VMOpcode::IF_GOTO || op == VMOpcode::FUNCTION || op == VMOpcode::CALL;
+        }
+        bool hasSegment(VMOpcode op) { return op == VMOpcode::PUSH || op == VMOpcode::POP; }
+        bool hasArg(VMOpcode op) { return hasSegment(op) || op == VMOpcode::FUNCTION || op == VMOpcode::CALL; }
+    }
+
+    uint32_t VMBytecodeWriter::intern(std::string_view name)
+    {
+        const auto [it, inserted] = m_nameIndex.try_emplace(std::string{ name }, static_cast<uint32_t>(m_names.size()));
+        if (inserted)
+            m_names.emplace_back(name);
+        return it->second;
+    }
+
+    std::string VMBytecodeWriter::data() const
+    {
+        std::string out{ vmBytecodeMagic };
+        out += static_cast<char>(vmBytecodeVersion);
+        writeVarint(out, static_cast<uint32_t>(m_names.size()));
+        for (const auto& name : m_names)
+        {
+            writeVarint(out, static_cast<uint32_t>(name.size()));
+            out += name;
+        }
+        writeVarint(out, static_cast<uint32_t>(m_code.size()));
+        for (const auto& instruction : m_code)
+        {
+            out += static_cast<char>(instruction.op);
+            if (hasSegment(instruction.op))
+                out += static_cast<char>(instruction.segment);
+            if (hasName(instruction.op))
+                writeVarint(out, instruction.name);
+            if (hasArg(instruction.op))
+                writeVarint(out, static_cast<uint32_t>(instruction.arg));
+        }
+        return out;
+    }
+
+    void VMBytecodeWriter::clear()
+    {
+        m_names.clear();
+        m_nameIndex.clear();
+        m_code.clear();
+    }
+
+    std::string readVMBytecode(std::string_view data, std::vector<std::string>& names, std::vector<VMInstruction>& code)
+    {
+        const std::string_view magic{ vmBytecodeMagic };
+        if (data.substr(0, magic.size()) != magic || data.size() <= magic.size())
+            return "Not VM bytecode";
+        data.remove_prefix(magic.size());
+        if (static_cast<uint8_t>(data.front()) != vmBytecodeVersion)
+            return "Unsupported VM bytecode version";
+        data.remove_prefix(1);
+
+        uint32_t count{};
+        if (!readVarint(data, count))
+            return "Truncated string table";
+        names.clear();
+        names.reserve(count);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint32_t size{};
+            if (!readVarint(data, size) || size > data.size())
+                return "Truncated string table";
+            names.emplace_back(data.substr(0, size));
+            data.remove_prefix(size);
+        }
+
+        if (!readVarint(data, count))
+            return "Truncated code";
+        code.clear();
+        code.reserve(count);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (data.empty() || static_cast<uint8_t>(data.front()) > static_cast<uint8_t>(VMOpcode::RETURN))
+                return "Invalid opcode at instruction " + std::to_string(i);
+            VMInstruction instruction{};
+            instruction.op = static_cast<VMOpcode>(data.front());
+            data.remove_prefix(1);
+            if (hasSegment(instruction.op))
+            {
+                if (data.empty() || static_cast<uint8_t>(data.front()) > static_cast<uint8_t>(VMSegment::POINTER))
+                    return "Invalid segment at instruction " + std::to_string(i);
+                instruction.segment = static_cast<VMSegment>(data.front());
+                data.remove_prefix(1);
+            }
+            uint32_t value{};
+            if (hasName(instruction.op))
+            {
+                if (!readVarint(data, instruction.name) || instruction.name >= names.size())
+                    return "Invalid name at instruction " + std::to_string(i);
+            }
+            if (hasArg(instruction.op))
+            {
+                if (!readVarint(data, value) || value > INT32_MAX)
+                    return "Invalid operand at instruction " + std::to_string(i);
+                instruction.arg = static_cast<int32_t>(value);
+            }
+            code.push_back(instruction);
+        }
+        return {};
+    }
+}
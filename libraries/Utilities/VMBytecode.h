@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Binary form of Hack VM code, written by the compiler and loaded by the VM translator in one read.
+// Layout: "HVMB", a version byte, the string table (count, then length prefixed names) and the
+// instructions (count, then an opcode byte followed by its operands). All numbers are LEB128 varints.
+
+namespace Utilities
+{
+    enum class VMOpcode : uint8_t { ADD, SUB, NEG, EQ, GT, LT, AND, OR, NOT, PUSH, POP, LABEL, GOTO, IF_GOTO, FUNCTION, CALL, RETURN };
+    enum class VMSegment : uint8_t { NONE, CONSTANT, LOCAL, ARGUMENT, THIS, THAT, STATIC, TEMP, POINTER };
+
+    // name indexes the string table: the label of branches and the function of functions and calls.
+    // arg is the segment index, local count or argument count.
+    struct VMInstruction
+    {
+        VMOpcode op{};
+        VMSegment segment{ VMSegment::NONE };
+        int32_t arg{};
+        uint32_t name{};
+    };
+
+    constexpr char vmBytecodeMagic[] = "HVMB";
+    constexpr uint8_t vmBytecodeVersion{ 1 };
+
+    class VMBytecodeWriter
+    {
+    public:
+        uint32_t intern(std::string_view name);
+        void add(const VMInstruction& instruction) { m_code.push_back(instruction); }
+        std::string data() const;
+        bool empty() const { return m_code.empty(); }
+        void clear();
+    private:
+        std::vector<std::string> m_names;
+        std::unordered_map<std::string, uint32_t> m_nameIndex;
+        std::vector<VMInstruction> m_code;
+    };
+
+    // Decode bytecode into its string table and instructions. Returns an error message, empty on success
+    std::string readVMBytecode(std::string_view data, std::vector<std::string>& names, std::vector<VMInstruction>& code);
+}
@@ -1,7 +1,161 @@
 #include <gtest/gtest.h>
+#include <fstream>
+
+#include "Assembler.h"
+
+namespace
+{
+    const std::string forwardReferences{
+        "// Forward label and variable references\n"
+        "@i\n"
+        "M=1\n"
+        "@END\n"
+        "0;JMP\n"
+        "(LOOP)\n"
+        "@sum\n"
+        "M=D+M\n"
+        "@LOOP\n"
+        "D;JGT\n"
+        "(END)\n"
+        "@END\n"
+        "0;JMP\n"
+        "@i\n"
+        "@SCREEN\n"
+    };
+
+    std::string assembleFile(const std::string& source, Assembler::Options options)
+    {
+        const std::string fileName{ "./AssemblerTest.asm" };
+        std::ofstream(fileName) << source;
+        Assembler::Assembler assembler{ options };
+        EXPECT_EQ(assembler.parse(fs::path{ fileName }), 0);
+        std::ifstream output{ "./AssemblerTest.hack" };
+        return std::string(std::istreambuf_iterator<char>(output), {});
+    }
+}
 
 TEST(Assembler, ParseLine)
 {
 	EXPECT_EQ(1, 1);
 }
 
+TEST(Assembler, SinglePassMatchesTwoPass)
+{
+    const std::string twoPass = assembleFile(forwardReferences, {});
+    Assembler::Options singlePass;
+    singlePass.singlePass = true;
+    EXPECT_EQ(assembleFile(forwardReferences, singlePass), twoPass);
+    EXPECT_EQ(twoPass.substr(0, 17 * 3), "0000000000010000\n1110111111001000\n0000000000001000\n");
+}
+
+TEST(Assembler, CInstructionFields)
+{
+    static_assert(*Assembler::compBits("D+M") == 0b1000010000000);
+    static_assert(*Assembler::destBits("AMD") == 0b111000);
+    static_assert(*Assembler::jumpBits("JMP") == 0b111);
+    static_assert(!Assembler::compBits("D+D"));
+    static_assert(!Assembler::destBits("DM"));
+
+    Assembler::Assembler assembler;
+    EXPECT_EQ(assembler.parseCodeLine("AM=M-1").bin, 0b1111110010101000);
+    EXPECT_EQ(assembler.parseCodeLine("D=D+1;JEQ").bin, 0b1110011111010010);
+    EXPECT_EQ(assembler.parseCodeLine("0;JMP").bin, 0b1110101010000111);
+    EXPECT_EQ(assembler.parseCodeLine("D=D+D").error, "Invalid computation");
+}
+
+TEST(Assembler, BinaryImage)
+{
+    const std::string fileName{ "./AssemblerTest.asm" };
+    std::ofstream(fileName) << forwardReferences;
+    const std::vector<uint16_t> words = Assembler::Assembler{}.assemble(forwardReferences).words;
+    ASSERT_EQ(words.size(), 12u);
+
+    for (const bool header : { false, true })
+    {
+        Assembler::Options options;
+        options.format = Assembler::OutputFormat::Binary;
+        options.romHeader = header;
+        EXPECT_TRUE(Assembler::Assembler{ options }.assembleFile(fs::path{ fileName }).ok());
+        std::ifstream output{ "./AssemblerTest.bin", std::ios::binary };
+        const std::string image(std::istreambuf_iterator<char>(output), {});
+
+        const size_t headerSize = header ? 12 : 0;
+        ASSERT_EQ(image.size(), headerSize + words.size() * 2);
+        const auto byte = [&image](size_t i) { return static_cast<uint8_t>(image[i]); };
+        if (header)
+        {
+            EXPECT_EQ(image.substr(0, 4), "HACK");
+            EXPECT_EQ(byte(4) | byte(5) << 8, Assembler::romVersion);
+            EXPECT_EQ(byte(6) | byte(7) << 8, 0);
+            EXPECT_EQ(byte(8) | byte(9) << 8 | byte(10) << 16 | byte(11) << 24, static_cast<int>(words.size()));
+        }
+        for (size_t i = 0; i < words.size(); i++)
+            EXPECT_EQ(byte(headerSize + i * 2) | byte(headerSize + i * 2 + 1) << 8, words[i]) << "word " << i;
+    }
+}
+
+TEST(Assembler, ParallelMatchesSerial)
+{
+    std::string source;
+    for (int i = 0; i < 3000; i++)
+    {
+        const std::string id{ std::to_string(i % 700) };
+        source += "(LABEL" + std::to_string(i) + ")\n@var" + id + "\nD=M\n@LABEL" + std::to_string(2999 - i) + "\nD;JNE\n";
+    }
+    const std::string serial = assembleFile(source, {});
+    Assembler::Options parallel;
+    parallel.threads = 4;
+    EXPECT_EQ(assembleFile(source, parallel), serial);
+}
+
+TEST(Assembler, SymbolTable)
+{
+    static_assert(*Assembler::predefinedSymbol("R15") == 15);
+    static_assert(*Assembler::predefinedSymbol("SCREEN") == 16384);
+    static_assert(!Assembler::predefinedSymbol("R16"));
+
+    Assembler::SymbolTable symbols;
+    EXPECT_FALSE(symbols.insert("THAT", 100));
+    EXPECT_EQ(symbols.find("THAT"), 4);
+    for (uint16_t i = 0; i < 5000; i++)
+        EXPECT_TRUE(symbols.insert("symbol" + std::to_string(i), i));
+    EXPECT_FALSE(symbols.insert("symbol42", 1));
+    EXPECT_EQ(symbols.find("symbol42"), 42);
+    EXPECT_EQ(symbols.find("symbol4999"), 4999);
+    EXPECT_EQ(symbols.size(), 5000);
+
+    symbols.clear();
+    EXPECT_FALSE(symbols.find("symbol42"));
+    EXPECT_TRUE(symbols.insert("symbol42", 7));
+    EXPECT_EQ(symbols.find("symbol42"), 7);
+}
+
+TEST(Assembler, AssembleInMemory)
+{
+    Assembler::Assembler assembler;
+    auto result = assembler.assemble(forwardReferences);
+    ASSERT_TRUE(result.ok());
+    ASSERT_EQ(result.words.size(), 12);
+    EXPECT_EQ(result.words[0], 16);
+    EXPECT_EQ(result.words[2], 8);
+    EXPECT_EQ(result.words[4], 17);
+
+    result = assembler.assemble("@1\n\nD=D+D\n(LOOP)\n  AMX=1\n(LOOP)\n");
+    EXPECT_FALSE(result.ok());
+    EXPECT_TRUE(result.words.empty());
+    ASSERT_EQ(result.diagnostics.size(), 1);
+    EXPECT_EQ(result.diagnostics[0].line, 6);
+    EXPECT_EQ(result.diagnostics[0].message, "Invalid User Symbol");
+
+    result = assembler.assemble("@1\n\nD=D+D\n(LOOP)\n  AMX=1\n");
+    ASSERT_EQ(result.diagnostics.size(), 2);
+    EXPECT_EQ(result.diagnostics[0].line, 3);
+    EXPECT_EQ(result.diagnostics[1].line, 5);
+    EXPECT_EQ(result.diagnostics[1].message, "Invalid destination");
+
+    // Assembling a file has the same contract: no words once there are diagnostics
+    std::ofstream("./AssemblerTest.asm") << "@1\n\nD=D+D\n(LOOP)\n  AMX=1\n";
+    result = assembler.assembleFile(fs::path{ "./AssemblerTest.asm" });
+    EXPECT_EQ(result.diagnostics.size(), 2);
+    EXPECT_TRUE(result.words.empty());
+}
@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 #include "Utilities.h"
+#include "VMBytecode.h"
 
 TEST(Utilities, SplitBySpaceKeepQuoted)
 {
@@ -39,4 +40,50 @@ TEST(Utilities, SplitBySpace)
     EXPECT_EQ(result.size(), 4);
     result = Utilities::splitBySpace("Add Add ");
     EXPECT_EQ(result.size(), 2);
-}
\ No newline at end of file
+}
+TEST(Utilities, NextLine)
+{
+    std::string_view text{ "  @SP\n\n\t  M=M+1 // inc\r\n(END)" };
+    EXPECT_EQ(Utilities::nextLine(text), "@SP");
+    EXPECT_EQ(Utilities::nextLine(text), "M=M+1 // inc\r");
+    EXPECT_EQ(Utilities::nextLine(text), "(END)");
+    EXPECT_TRUE(text.empty());
+    EXPECT_EQ(Utilities::trimSpaceAndComment("M=M+1 // inc"), "M=M+1");
+}
+TEST(Utilities, VMBytecode)
+{
+    Utilities::VMBytecodeWriter writer;
+    const auto name = writer.intern("Main.main");
+    writer.add({ Utilities::VMOpcode::FUNCTION, Utilities::VMSegment::NONE, 3, name });
+    writer.add({ Utilities::VMOpcode::PUSH, Utilities::VMSegment::CONSTANT, 1000 });
+    writer.add({ Utilities::VMOpcode::NOT });
+    const std::string data = writer.data();
+
+    std::vector<std::string> names;
+    std::vector<Utilities::VMInstruction> code;
+    EXPECT_EQ(Utilities::readVMBytecode(data, names, code), "");
+    EXPECT_EQ(names, std::vector<std::string>{ "Main.main" });
+    ASSERT_EQ(code.size(), 3u);
+    EXPECT_EQ(code[0].op, Utilities::VMOpcode::FUNCTION);
+    EXPECT_EQ(code[0].arg, 3);
+    EXPECT_EQ(code[1].segment, Utilities::VMSegment::CONSTANT);
+    EXPECT_EQ(code[1].arg, 1000);
+    EXPECT_EQ(code[2].op, Utilities::VMOpcode::NOT);
+
+    EXPECT_EQ(Utilities::readVMBytecode("push constant 1", names, code), "Not VM bytecode");
+    EXPECT_NE(Utilities::readVMBytecode(data.substr(0, data.size() - 2), names, code), "");
+}
+TEST(Utilities, OutputBuffer)
+{
+    std::ostringstream sink;
+    {
+        Utilities::OutputBuffer buffer{ sink, 8 };
+        buffer.append("@SP\n");
+        buffer.append("M=M+1\n");
+        EXPECT_EQ(sink.str(), "@SP\n");
+        buffer.append("// a comment longer than a chunk\n");
+        EXPECT_EQ(sink.str(), "@SP\nM=M+1\n// a comment longer than a chunk\n");
+        buffer.append("(END)\n");
+    }
+    EXPECT_EQ(sink.str(), "@SP\nM=M+1\n// a comment longer than a chunk\n(END)\n");
+}
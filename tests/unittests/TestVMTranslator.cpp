@@ -1,11 +1,384 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <fstream>
+#include <iterator>
 
+#include "Assembler.h"
 #include "VMTranslator.h"
+#include "Peephole.h"
+#include "VMPasses.h"
+#include "VMProgram.h"
 
 TEST(VMTranslator, ParseLine)
 {
     //VMTranslator::Translator translator;
     //translator.parse();
     EXPECT_EQ(1, 1);
-}
\ No newline at end of file
+}
+
+TEST(VMTranslator, Peephole)
+{
+    // push constant 7, pop static 0
+    auto result = VMTranslator::peephole({
+        "// push constant 7\n@7\nD=A\n@SP\nA=M\nM=D\n@SP\nM=M+1\n",
+        "// pop static 0\n@SP\nAM=M-1\nD=M\n@Foo.0\nM=D\n" });
+    std::vector<std::string> expected{ "// push constant 7\n@7", "D=A", "// pop static 0\n@Foo.0", "M=D" };
+    EXPECT_EQ(result, expected);
+
+    // Dead store in add and a jump over nothing
+    result = VMTranslator::peephole({ "@SP\nM=M-1\nA=M\nD=M\nM=0\nA=A-1\nM=D+M\n@END\n0;JMP\n@1\n(END)\n" });
+    expected = { "@SP", "AM=M-1", "D=M", "A=A-1", "M=D+M", "(END)" };
+    EXPECT_EQ(result, expected);
+}
+
+TEST(VMTranslator, SharedCompare)
+{
+    VMTranslator::Options options;
+    options.sharedCompare = true;
+    VMTranslator::Translator translator{ fs::path{ "./Test.asm" }, options };
+    const auto result = translator.parseCodeLine("gt", false);
+    EXPECT_TRUE(result.first.empty());
+    EXPECT_EQ(result.second, "@GT.0\nD=A\n@$$GT\n0;JMP\n(GT.0)\n");
+}
+
+TEST(VMTranslator, Program)
+{
+    VMTranslator::Program program;
+    const auto file = program.intern("Main");
+    EXPECT_EQ(program.parse("// comment\n\nfunction Main.main 2\n  push static 3 // x\r\ncall Main.f 1\nif-goto LOOP\nnot\n", file), "");
+    ASSERT_EQ(program.code.size(), 5u);
+    EXPECT_EQ(program.code[0].op, VMTranslator::Opcode::FUNCTION);
+    EXPECT_EQ(program.code[0].arg, 2);
+    EXPECT_EQ(program.code[1].segment, VMTranslator::Segment::STATIC);
+    EXPECT_EQ(program.code[1].name, file);
+    EXPECT_EQ(program.toString(program.code[1]), "push static 3");
+    EXPECT_EQ(program.toString(program.code[2]), "call Main.f 1");
+    EXPECT_EQ(program.names[program.code[3].name], "LOOP");
+    EXPECT_EQ(program.code[4].op, VMTranslator::Opcode::NOT);
+
+    EXPECT_EQ(program.parse("push local 1\npop constant 2\n", file), "ln-2: C_POP: Invalid instruction");
+    EXPECT_EQ(program.parse("push pointer 2", file), "ln-1: C_PUSH: Invalid instruction");
+    EXPECT_EQ(program.parse("jump", file), "ln-1: Invalid command jump");
+}
+
+TEST(VMTranslator, FoldConstants)
+{
+    VMTranslator::Program program;
+    const auto file = program.intern("Main");
+    EXPECT_EQ(program.parse(
+        "push constant 2\npush constant 3\nadd\nneg\n"      // -5
+        "push local 0\npush constant 0\nadd\nnot\nnot\n"    // local 0
+        "push constant 1\npush constant 2\ngt\nif-goto END\n"
+        "push constant 1\nneg\nif-goto LOOP\n", file), "");
+    VMTranslator::foldConstants(program);
+
+    std::vector<std::string> result;
+    for (const auto& instruction : program.code)
+        result.push_back(program.toString(instruction));
+    const std::vector<std::string> expected{ "push constant 4", "not", "push local 0", "goto LOOP" };
+    EXPECT_EQ(result, expected);
+}
+
+TEST(VMTranslator, FoldConstantsOverflow)
+{
+    // 30000 - -30000 wraps to a negative number, and the generated gt and lt go by its sign
+    VMTranslator::Program program;
+    const auto file = program.intern("Main");
+    EXPECT_EQ(program.parse(
+        "push constant 30000\npush constant 0\npush constant 30000\nsub\ngt\n"
+        "push constant 0\npush constant 30000\nsub\npush constant 30000\nlt\n", file), "");
+    VMTranslator::foldConstants(program);
+
+    std::vector<std::string> result;
+    for (const auto& instruction : program.code)
+        result.push_back(program.toString(instruction));
+    const std::vector<std::string> expected{ "push constant 0", "push constant 0" };
+    EXPECT_EQ(result, expected);
+}
+
+TEST(VMTranslator, RemoveDeadFunctions)
+{
+    VMTranslator::Program sys, main;
+    EXPECT_EQ(sys.parse("function Sys.init 0\ncall Main.main 0\nlabel HALT\ngoto HALT\n"
+        "function Sys.halt 0\ncall Sys.halt 0\nreturn\n", sys.intern("Sys")), "");
+    EXPECT_EQ(main.parse("function Main.main 0\ncall Main.f 0\nreturn\n"
+        "function Main.f 0\ncall Main.main 0\nreturn\n"
+        "function Main.unused 0\ncall Main.f 0\nreturn\n", main.intern("Main")), "");
+    EXPECT_EQ(VMTranslator::removeDeadFunctions({ &sys, &main }), 2u);
+
+    std::vector<std::string> functions;
+    for (const auto* program : { &sys, &main })
+        for (const auto& instruction : program->code)
+            if (instruction.op == VMTranslator::Opcode::FUNCTION)
+                functions.push_back(program->names[instruction.name]);
+    const std::vector<std::string> expected{ "Sys.init", "Main.main", "Main.f" };
+    EXPECT_EQ(functions, expected);
+    EXPECT_EQ(main.code.size(), 6u);
+
+    // Without an entry point nothing is known to be dead
+    EXPECT_EQ(VMTranslator::removeDeadFunctions({ &main }), 0u);
+}
+
+TEST(VMTranslator, InlineFunctions)
+{
+    VMTranslator::Program main, point;
+    EXPECT_EQ(main.parse("function Main.main 1\npush local 0\ncall Point.getX 1\npop temp 0\n"
+        "push constant 5\ncall Point.abs 1\nreturn\n", main.intern("Main")), "");
+    EXPECT_EQ(point.parse("function Point.getX 0\npush argument 0\npop pointer 0\npush this 0\nreturn\n"
+        "function Point.abs 0\npush argument 0\npush constant 0\nlt\nif-goto NEG\npush argument 0\nreturn\n"
+        "label NEG\npush argument 0\nneg\nreturn\n"
+        "function Point.loop 0\ncall Point.loop 0\nreturn\n", point.intern("Point")), "");
+    EXPECT_EQ(VMTranslator::inlineFunctions({ &main, &point }, 10), 2u);
+
+    std::vector<std::string> result;
+    for (const auto& instruction : main.code)
+        result.push_back(main.toString(instruction));
+    const std::vector<std::string> expected{ "function Main.main 1", "push local 0",
+        // temp 0 is used by the program, so inlined arguments and saved pointers start at temp 1
+        "pop temp 1", "push pointer 0", "pop temp 2", "push temp 1", "pop pointer 0", "push this 0", "push temp 2", "pop pointer 0",
+        "pop temp 0", "push constant 5",
+        "pop temp 1", "push temp 1", "push constant 0", "lt", "if-goto NEG$inline1", "push temp 1", "goto Point.abs$return$inline1",
+        "label NEG$inline1", "push temp 1", "neg", "label Point.abs$return$inline1",
+        "return" };
+    EXPECT_EQ(result, expected);
+
+    // Functions that make calls are never inlined
+    EXPECT_EQ(VMTranslator::inlineFunctions({ &point }, 10), 0u);
+}
+
+namespace
+{
+    // Translate source as the file Foo, returning the written assembly
+    std::string translate(const std::string& source, const VMTranslator::Options& options)
+    {
+        VMTranslator::Translator translator{ fs::path{ "./VMTranslatorTest.asm" }, options };
+        translator.setCurrentFile("Foo");
+        EXPECT_EQ(translator.parseUnit(source), 0);
+        translator.generate();
+        EXPECT_EQ(translator.write("./VMTranslatorTest.asm"), 0);
+        std::ifstream output{ "./VMTranslatorTest.asm" };
+        return { std::istreambuf_iterator<char>(output), std::istreambuf_iterator<char>() };
+    }
+
+    // Translate the files, Sys first, with the bootstrap, assemble the result and run it on the Hack
+    // CPU for the given number of instructions, returning the RAM
+    std::vector<int16_t> run(const std::vector<std::string>& sources, const VMTranslator::Options& options, int cycles)
+    {
+        std::vector<fs::path> inputs;
+        for (size_t i = 0; i < sources.size(); i++)
+        {
+            const std::string fileName = "./VMTranslatorRun" + std::to_string(i) + ".vm";
+            std::ofstream{ fileName } << sources[i];
+            inputs.emplace_back(fileName);
+        }
+        VMTranslator::Translator translator{ fs::path{ "./VMTranslatorTest.asm" }, options };
+        EXPECT_EQ(translator.parse(inputs), 0);
+        std::ifstream output{ "./VMTranslatorTest.asm" };
+        const std::string assembly{ std::istreambuf_iterator<char>(output), std::istreambuf_iterator<char>() };
+        const Assembler::AssemblyResult rom = Assembler::Assembler{}.assemble(assembly);
+        EXPECT_TRUE(rom.ok());
+
+        std::vector<int16_t> ram(32768);
+        uint16_t a{};
+        int16_t d{};
+        size_t pc{};
+        for (int cycle = 0; cycle < cycles && pc < rom.words.size(); cycle++)
+        {
+            const uint16_t instruction = rom.words[pc];
+            if (!(instruction & 0x8000))
+            {
+                a = instruction;
+                pc++;
+                continue;
+            }
+            // ALU control bits zx nx zy ny f no, then dest A D M and jump lt eq gt
+            int16_t x = d;
+            int16_t y = (instruction & 0x1000) ? ram[a & 0x7FFF] : static_cast<int16_t>(a);
+            if (instruction & 0x800) x = 0;
+            if (instruction & 0x400) x = static_cast<int16_t>(~x);
+            if (instruction & 0x200) y = 0;
+            if (instruction & 0x100) y = static_cast<int16_t>(~y);
+            int16_t out = (instruction & 0x80) ? static_cast<int16_t>(x + y) : static_cast<int16_t>(x & y);
+            if (instruction & 0x40) out = static_cast<int16_t>(~out);
+            const bool jump = ((instruction & 4) && out < 0) || ((instruction & 2) && out == 0) || ((instruction & 1) && out > 0);
+            const uint16_t target = a;
+            if (instruction & 0x08) ram[a & 0x7FFF] = out;
+            if (instruction & 0x20) a = static_cast<uint16_t>(out);
+            if (instruction & 0x10) d = out;
+            pc = jump ? target : pc + 1;
+        }
+        return ram;
+    }
+}
+
+TEST(VMTranslator, FuseMoves)
+{
+    VMTranslator::Options options;
+    options.fuseMoves = true;
+    EXPECT_EQ(translate("push local 1\npop static 2\npush argument 0\npush constant 7\nsub\npop this 5\n", options),
+        "// push local 1\n// pop static 2\n@LCL\nA=M+1\nD=M\n@Foo.2\nM=D\n\n"
+        "// push argument 0\n// push constant 7\n// sub\n// pop this 5\n"
+        "@ARG\nA=M\nD=M\n@7\nD=D-A\n@R13\nM=D\n@THIS\nD=D+M\n@5\nD=D+A\n@R13\nA=D-M\nM=D-A\n\n");
+}
+
+TEST(VMTranslator, CacheTop)
+{
+    VMTranslator::Options options;
+    options.cacheTop = true;
+    EXPECT_EQ(translate("push local 0\npush constant 1\nadd\npop local 0\npush argument 1\nlabel L\n", options),
+        "// push local 0\n@LCL\nA=M\nD=M\n\n"
+        "// push constant 1\n@SP\nM=M+1\nA=M-1\nM=D\n@1\nD=A\n\n"
+        "// add\n@SP\nAM=M-1\nD=D+M\n\n"
+        "// pop local 0\n@LCL\nA=M\nM=D\n\n"
+        "// push argument 1\n@ARG\nA=M+1\nD=M\n\n"
+        "// label L\n@SP\nM=M+1\nA=M-1\nM=D\n(L)\n\n");
+}
+
+TEST(VMTranslator, CompareBranch)
+{
+    VMTranslator::Options options;
+    options.cacheTop = true;
+    options.compareBranch = true;
+    EXPECT_EQ(translate("push local 0\npush constant 10\nlt\nnot\nif-goto END\n", options),
+        "// push local 0\n@LCL\nA=M\nD=M\n\n"
+        "// push constant 10\n@SP\nM=M+1\nA=M-1\nM=D\n@10\nD=A\n\n"
+        "// lt\n// not\n// if-goto END\n@SP\nAM=M-1\nD=M-D\n@END\nD;JGE\n\n");
+}
+
+TEST(VMTranslator, PopAddressing)
+{
+    VMTranslator::Translator translator{ fs::path{ "./VMTranslatorTest.asm" } };
+    EXPECT_EQ(translator.parseCodeLine("pop that 2", false).second, "@SP\nAM=M-1\nD=M\n@THAT\nA=M+1\nA=A+1\nM=D\n");
+    EXPECT_EQ(translator.parseCodeLine("pop argument 9", false).second,
+        "@SP\nAM=M-1\nD=M\n@R13\nM=D\n@ARG\nD=D+M\n@9\nD=D+A\n@R13\nA=D-M\nM=D-A\n");
+}
+
+TEST(VMTranslator, FunctionLocals)
+{
+    VMTranslator::Options options;
+    options.localLoopThreshold = 4;
+    VMTranslator::Translator translator{ fs::path{ "./VMTranslatorTest.asm" }, options };
+    EXPECT_EQ(translator.parseCodeLine("function f 0", false).second, "(f)\n");
+    EXPECT_EQ(translator.parseCodeLine("function f 2", false).second, "(f)\n@SP\nM=M+1\nM=M+1\nA=M-1\nM=0\nA=A-1\nM=0\n");
+    EXPECT_EQ(translator.parseCodeLine("function f 3", false).second, "(f)\n@SP\nA=M\nM=0\nA=A+1\nM=0\nA=A+1\nM=0\nD=A+1\n@SP\nM=D\n");
+    EXPECT_EQ(translator.parseCodeLine("function f 9", false).second,
+        "(f)\n@9\nD=A\n(f$LOCALS)\n@SP\nAM=M+1\nA=A-1\nM=0\n@f$LOCALS\nD=D-1;JGT\n");
+}
+
+TEST(VMTranslator, ParallelMatchesSerial)
+{
+    const std::vector<std::string> sources{
+        "function Sys.init 0\ncall Main.main 0\nlabel HALT\ngoto HALT\n",
+        "function Main.main 1\npush constant 3\npush constant 4\nlt\npop local 0\npush static 0\ncall Main.f 1\nreturn\n",
+        "function Main.f 0\npush argument 0\npush argument 0\neq\nreturn\n" };
+    std::vector<fs::path> inputs;
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        const std::string fileName = "./VMTranslatorTest" + std::to_string(i) + ".vm";
+        std::ofstream{ fileName } << sources[i];
+        inputs.emplace_back(fileName);
+    }
+    std::vector<std::string> results;
+    for (const unsigned threads : { 1u, 3u })
+    {
+        VMTranslator::Options options;
+        options.threads = threads;
+        VMTranslator::Translator translator{ fs::path{ "./VMTranslatorTest.asm" }, options };
+        EXPECT_EQ(translator.parse(inputs), 0);
+        std::ifstream output{ "./VMTranslatorTest.asm" };
+        results.emplace_back(std::istreambuf_iterator<char>(output), std::istreambuf_iterator<char>());
+    }
+    EXPECT_EQ(results[0], results[1]);
+    // Labels are namespaced by file
+    EXPECT_NE(results[0].find("(LT.VMTranslatorTest1.0)"), std::string::npos);
+    EXPECT_NE(results[0].find("(EQ.VMTranslatorTest2.0)"), std::string::npos);
+}
+
+TEST(VMTranslator, Stream)
+{
+    const std::vector<std::string> sources{
+        "function Sys.init 0\ncall Main.main 0\nlabel HALT\ngoto HALT\n",
+        "function Main.main 0\npush constant 3\npush constant 4\nlt\nreturn\n" };
+    std::vector<fs::path> inputs;
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        const std::string fileName = "./VMTranslatorStream" + std::to_string(i) + ".vm";
+        std::ofstream{ fileName } << sources[i];
+        inputs.emplace_back(fileName);
+    }
+    std::vector<std::string> results;
+    for (const bool stream : { false, true })
+    {
+        VMTranslator::Options options;
+        options.stream = stream;
+        VMTranslator::Translator translator{ fs::path{ "./VMTranslatorTest.asm" }, options };
+        EXPECT_EQ(translator.parse(inputs), 0);
+        std::ifstream output{ "./VMTranslatorTest.asm" };
+        results.emplace_back(std::istreambuf_iterator<char>(output), std::istreambuf_iterator<char>());
+    }
+    EXPECT_FALSE(results[0].empty());
+    EXPECT_EQ(results[0], results[1]);
+}
+
+TEST(VMTranslator, TailCalls)
+{
+    VMTranslator::Options options;
+    options.tailCalls = true;
+    const std::string tailCall{ "// call Bar.f 2\n// return\n@2\nD=A\n@R13\nM=D\n@Bar.f\nD=A\n@$$TAILCALL\n0;JMP\n\n// call Bar.g 0\n" };
+    EXPECT_EQ(translate("call Bar.f 2\nreturn\ncall Bar.g 0\npop temp 0\n", options).substr(0, tailCall.size()), tailCall);
+    EXPECT_NE(VMTranslator::sharedRoutines(options).find("($$TAILCALL)"), std::string::npos);
+
+    // Main.start tail calls with more arguments than it has, moving the frame, and Main.sum tail calls
+    // itself with as many, keeping it. The sum has to reach Sys.init through the reused frames.
+    const std::vector<std::string> sources{
+        "function Sys.init 0\npush constant 100\ncall Main.start 1\npop temp 0\nlabel HALT\ngoto HALT\n",
+        "function Main.start 0\npush argument 0\npush constant 0\ncall Main.sum 2\nreturn\n"
+        "function Main.sum 1\npush argument 0\nif-goto MORE\npush argument 1\nreturn\nlabel MORE\n"
+        "push argument 0\npush constant 1\nsub\npush argument 1\npush argument 0\nadd\ncall Main.sum 2\nreturn\n" };
+    for (const bool tailCalls : { false, true })
+    {
+        options.tailCalls = tailCalls;
+        const auto ram = run(sources, options, 200000);
+        EXPECT_EQ(ram[5], 5050);
+        EXPECT_EQ(ram[0], 261);
+        // 100 nested frames take the stack past 600, reused ones never get there
+        const bool deep = std::any_of(ram.begin() + 600, ram.begin() + 900, [](int16_t word) { return word != 0; });
+        EXPECT_EQ(deep, !tailCalls);
+    }
+    options.cacheTop = options.sharedCallReturn = true;
+    EXPECT_EQ(run(sources, options, 200000)[5], 5050);
+}
+
+TEST(VMTranslator, SharedCallReturn)
+{
+    VMTranslator::Options options;
+    options.sharedCallReturn = true;
+    EXPECT_EQ(translate("call Bar.f 2\nreturn\n", options),
+        "// call Bar.f 2\n@Bar.f\nD=A\n@R13\nM=D\n@7\nD=A\n@R15\nM=D\n@RETURN.Foo.0\nD=A\n@$$CALL\n0;JMP\n(RETURN.Foo.0)\n\n"
+        "// return\n@$$RETURN\n0;JMP\n\n");
+
+    // A single file has no bootstrap, so the routines are jumped over
+    const std::string fileName{ "./VMTranslatorSingle.vm" };
+    std::ofstream{ fileName } << "push constant 1\n";
+    VMTranslator::Translator translator{ fs::path{ "./VMTranslatorTest.asm" }, options };
+    EXPECT_EQ(translator.parse({ fs::path{ fileName } }), 0);
+    std::ifstream output{ "./VMTranslatorTest.asm" };
+    const std::string assembly{ std::istreambuf_iterator<char>(output), std::istreambuf_iterator<char>() };
+    EXPECT_EQ(assembly.rfind("@$$START\n0;JMP\n//Shared call and return\n($$CALL)\n", 0), 0u);
+    EXPECT_LT(assembly.find("($$RETURN)"), assembly.find("($$START)\n"));
+    EXPECT_LT(assembly.find("($$START)\n"), assembly.find("// push constant 1"));
+
+    // Round trip through nested calls, against the inline protocol
+    const std::vector<std::string> sources{
+        "function Sys.init 0\npush constant 5\npush constant 7\ncall Main.twice 2\npop temp 0\nlabel HALT\ngoto HALT\n",
+        "function Main.twice 0\npush argument 0\npush argument 1\ncall Main.add 2\npush argument 1\ncall Main.add 2\nreturn\n"
+        "function Main.add 1\npush argument 0\npush argument 1\nadd\npop local 0\npush local 0\nreturn\n" };
+    for (const bool shared : { false, true })
+    {
+        options.sharedCallReturn = shared;
+        const auto ram = run(sources, options, 5000);
+        EXPECT_EQ(ram[5], 19);
+        EXPECT_EQ(ram[0], 261); // SP back to just above the frame of Sys.init
+    }
+}